@@ -1,10 +1,21 @@
 #ifndef FREETURES_CONVENIENCE_HPP
 #define FREETURES_CONVENIENCE_HPP
 
+#include "freetures/detail/config.hpp"
+
+#include "freetures/cancellation.hpp"
+#include "freetures/error.hpp"
 #include "freetures/future.hpp"
+#include "freetures/pipeline.hpp"
 #include "freetures/promise.hpp"
 #include "freetures/scheduler.hpp"
+#include "freetures/shared_future.hpp"
+#include "freetures/stream_descriptor.hpp"
+#include "freetures/task.hpp"
 #include "freetures/time.hpp"
+#include "freetures/timer.hpp"
 #include "freetures/uart.hpp"
+#include "freetures/when_all.hpp"
+#include "freetures/when_any.hpp"
 
 #endif
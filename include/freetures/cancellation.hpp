@@ -0,0 +1,120 @@
+#ifndef FREETURES_CANCELLATION_HPP
+#define FREETURES_CANCELLATION_HPP
+
+#include "detail/cancellation_state.hpp"
+#include "detail/ref_count.hpp"
+
+namespace ft {
+
+class cancellation_source;
+class scheduler;
+class stream_descriptor;
+
+namespace detail {
+template<typename T> class when_any_block;
+} // detail
+
+/**
+ * @brief Lets an asynchronous operation learn that its result is no longer
+ * wanted.
+ *
+ * A token is handed to the functions that start operations (e.g. @ref
+ * scheduler::wait), and is cancelled through the @ref cancellation_source it
+ * was obtained from. A default constructed token is never cancelled.
+ *
+ * Tokens are cheap to copy: they share the state of their source.
+ */
+class cancellation_token
+{
+    friend class cancellation_source;
+    friend class scheduler;
+    friend class stream_descriptor;
+
+    detail::intrusive_ptr<detail::cancellation_state> state_;
+
+    explicit cancellation_token(detail::intrusive_ptr<detail::cancellation_state> state)
+        : state_(std::move(state))
+    {}
+
+public:
+    cancellation_token() = default;
+
+    /** Whether the token is associated with a source at all. */
+    bool can_be_cancelled() const noexcept
+    {
+        return bool(state_);
+    }
+
+    bool is_cancellation_requested() const noexcept
+    {
+        return state_ && state_->is_cancelled();
+    }
+};
+
+/**
+ * @brief Cancels the operations started with its tokens.
+ *
+ * Cancelling withdraws the pending operations right away, where possible in
+ * O(1): a timer is removed from the scheduler's timer wheel and the memory of
+ * its operation is released, instead of lingering until it would have expired,
+ * and a read or write is removed from its descriptor's queue in the reactor
+ * (see @ref stream_descriptor).
+ * The futures of cancelled operations complete on the cancelled path (see @ref
+ * future::on_cancel), as do the futures chained to them.
+ *
+ * @code
+ * ft::cancellation_source cancel_query;
+ * scheduler.defer([&] { return modem.query_signal(); },
+ *         ft::milliseconds(500), cancel_query.get_token())
+ *     .then([](int rssi) {
+ *         // Not invoked if the query is cancelled.
+ *     }).on_cancel([] {
+ *         // The link went down in the meantime.
+ *     });
+ *
+ * // Later, when the result is no longer needed:
+ * cancel_query.cancel();
+ * @endcode
+ *
+ * With a scheduler run by a single thread, an operation can only be withdrawn
+ * right away if the source is cancelled by the thread running the scheduler.
+ * Otherwise the operation still completes on the cancelled path, but only when
+ * it would have completed anyway.
+ */
+class cancellation_source
+{
+    template<typename T>
+    friend class detail::when_any_block;
+
+    detail::intrusive_ptr<detail::cancellation_state> state_;
+
+public:
+    cancellation_source()
+        : state_(detail::cancellation_state::create())
+    {}
+
+    cancellation_token get_token() const
+    {
+        return cancellation_token(state_);
+    }
+
+    bool is_cancellation_requested() const noexcept
+    {
+        return state_->is_cancelled();
+    }
+
+    /**
+     * @brief Requests the cancellation of all operations started with the
+     * tokens of this source, now and in the future.
+     *
+     * @return False if cancellation had already been requested.
+     */
+    bool cancel()
+    {
+        return state_->cancel();
+    }
+};
+
+} // ft
+
+#endif
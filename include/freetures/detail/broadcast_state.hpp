@@ -0,0 +1,240 @@
+#ifndef FREETURES_BROADCAST_STATE_HPP
+#define FREETURES_BROADCAST_STATE_HPP
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <utility>
+
+#include "config.hpp"
+#include "op_queue.hpp"
+#include "ref_count.hpp"
+#include "scheduler.hpp"
+#include "shared_state.hpp"
+#include "small_vector.hpp"
+#include "unique_function.hpp"
+
+namespace ft {
+namespace detail {
+
+/**
+ * The state behind a @ref shared_future: the result of a future, once it's
+ * there, and the continuations of the shared future's subscribers.
+ *
+ * The state is the single continuation of the future it shares, through which
+ * it receives the result, which it moves into itself. Subscribers are then
+ * invoked with a const reference to it, so however many there are, the value
+ * is never copied. The first few subscribers are stored in the state itself.
+ *
+ * Subscribers may be added by any thread, while the result is delivered by
+ * another. Subscribers that are added once the result is there are invoked
+ * from the scheduler's ready queue, in which the state enqueues itself (which
+ * is why it's a @ref scheduler_op), like a @ref shared_state does.
+ */
+template<typename T>
+class broadcast_state : public scheduler_op
+{
+#if FREETURES_HAS_THREADS
+    using mutex_type = std::mutex;
+#else
+    struct mutex_type
+    {
+        void lock() noexcept {}
+        void unlock() noexcept {}
+    };
+#endif
+
+public:
+    using subscriber = unique_function<void(completion<const T>)>;
+
+    // The number of subscribers that are stored in place.
+    static constexpr std::size_t num_inline_subscribers = 3;
+
+private:
+    enum status_type : unsigned char
+    {
+        not_ready,
+        ready,
+        // Failed with an error or a timeout (see completion).
+        failed,
+        cancelled,
+    };
+
+    union storage
+    {
+        storage() noexcept {}
+        ~storage() {}
+
+        T value;
+        std::error_code error;
+    };
+
+    ref_count refs_;
+    mutex_type mutex_;
+    status_type status_ = not_ready;
+    // Set while the state is in the scheduler's ready queue.
+    bool queued_ = false;
+    storage storage_;
+    scheduler& scheduler_;
+    small_vector<subscriber, num_inline_subscribers> subscribers_;
+
+    explicit broadcast_state(scheduler& s)
+        : scheduler_op(&broadcast_state::do_complete)
+        , scheduler_(s)
+    {}
+
+    ~broadcast_state()
+    {
+        if(status_ == ready) {
+            storage_.value.~T();
+        }
+    }
+
+public:
+    /**
+     * Allocates a state from the pool of @p s.
+     *
+     * @return The state, with a single reference owned by the caller.
+     */
+    static intrusive_ptr<broadcast_state> create(scheduler& s)
+    {
+        void* p = s.get_allocator().allocate(sizeof(broadcast_state));
+        return intrusive_ptr<broadcast_state>(::new(p) broadcast_state(s));
+    }
+
+    void add_ref() noexcept
+    {
+        refs_.increment();
+    }
+
+    void release() noexcept
+    {
+        if(refs_.decrement()) {
+            scheduler& s = scheduler_;
+            this->~broadcast_state();
+            s.get_allocator().deallocate(this, sizeof(broadcast_state));
+        }
+    }
+
+    scheduler& get_scheduler() noexcept
+    {
+        return scheduler_;
+    }
+
+    /**
+     * Adds a subscriber, which is invoked with the result once it's there. If
+     * the shared future has been cancelled, the subscriber is dropped instead,
+     * which cancels the future it fulfils.
+     */
+    void subscribe(subscriber&& s)
+    {
+        std::unique_lock<mutex_type> lock(mutex_);
+        if(status_ == cancelled) {
+            lock.unlock();
+            s.reset();
+            return;
+        }
+        subscribers_.push_back(std::move(s));
+        if(status_ != not_ready && !queued_) {
+            queued_ = true;
+            add_ref();
+            lock.unlock();
+            scheduler_.post_ready_op(this);
+        }
+    }
+
+    /** Stores the result of the shared future and invokes the subscribers. */
+    void complete(completion<T> c)
+    {
+        std::unique_lock<mutex_type> lock(mutex_);
+        if(c.has_value()) {
+            ::new(&storage_.value) T(std::move(c.value()));
+            status_ = ready;
+        } else {
+            ::new(&storage_.error) std::error_code(c.error());
+            status_ = failed;
+        }
+        auto subscribers = std::move(subscribers_);
+        lock.unlock();
+        invoke(subscribers);
+    }
+
+    /** Cancels the futures of the subscribers, by dropping them. */
+    void cancel()
+    {
+        std::unique_lock<mutex_type> lock(mutex_);
+        status_ = cancelled;
+        auto subscribers = std::move(subscribers_);
+        lock.unlock();
+    }
+
+private:
+    // The result, as seen by subscribers. Only valid once the state is no
+    // longer not_ready, after which it no longer changes.
+    completion<const T> result() const noexcept
+    {
+        return status_ == ready ? completion<const T>(&storage_.value)
+            : completion<const T>(storage_.error);
+    }
+
+    void invoke(small_vector<subscriber, num_inline_subscribers>& subscribers)
+    {
+        const completion<const T> c = result();
+        for(subscriber& s : subscribers) {
+            s(c);
+        }
+    }
+
+    static void do_complete(scheduler_op* op)
+    {
+        auto* state = static_cast<broadcast_state*>(op);
+        // Take over the queue's reference.
+        intrusive_ptr<broadcast_state> self(state);
+        std::unique_lock<mutex_type> lock(state->mutex_);
+        state->queued_ = false;
+        auto subscribers = std::move(state->subscribers_);
+        lock.unlock();
+        // While the scheduler is destroyed, the subscribers are dropped,
+        // which cancels their futures.
+        if(!state->scheduler_.is_shutting_down()) {
+            state->invoke(subscribers);
+        }
+    }
+};
+
+/**
+ * The continuation through which a @ref broadcast_state receives the result
+ * of the future it shares. If it's dropped without having been invoked, the
+ * shared future has been cancelled.
+ */
+template<typename T>
+class broadcast_continuation
+{
+    intrusive_ptr<broadcast_state<T>> state_;
+
+public:
+    explicit broadcast_continuation(intrusive_ptr<broadcast_state<T>> state)
+        : state_(std::move(state))
+    {}
+
+    broadcast_continuation(broadcast_continuation&&) noexcept = default;
+
+    ~broadcast_continuation()
+    {
+        if(state_) {
+            state_->cancel();
+        }
+    }
+
+    void operator()(completion<T> c)
+    {
+        auto state = std::move(state_);
+        state->complete(c);
+    }
+};
+
+} // detail
+} // ft
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef FREETURES_CANCELLATION_STATE_HPP
+#define FREETURES_CANCELLATION_STATE_HPP
+
+#include <atomic>
+#include <mutex>
+
+#include "config.hpp"
+#include "ref_count.hpp"
+
+namespace ft {
+namespace detail {
+
+class cancellation_state;
+
+/**
+ * The hook through which a pending operation learns that it's been cancelled.
+ *
+ * Operations that may be cancelled embed a callback and register it with the
+ * cancellation state of the token they were started with. Like @ref
+ * scheduler_op, the callback is an intrusive list node that calls a plain
+ * function pointer, so registering and deregistering it is O(1) and doesn't
+ * allocate.
+ */
+class cancellation_callback
+{
+    friend class cancellation_state;
+
+public:
+    using func_type = void (*)(cancellation_callback*);
+
+private:
+    cancellation_callback* prev_ = nullptr;
+    cancellation_callback* next_ = nullptr;
+    func_type func_;
+    bool registered_ = false;
+
+protected:
+    explicit cancellation_callback(func_type f) noexcept : func_(f) {}
+    ~cancellation_callback() = default;
+};
+
+/**
+ * The state shared by a cancellation source and its tokens: whether
+ * cancellation has been requested, and the callbacks of the operations to
+ * notify when it is.
+ *
+ * Callbacks are invoked with the state's lock held, so that an operation that
+ * deregisters its callback on another thread can't go away while its callback
+ * is running: deregistering waits for it to return. Hence callbacks must not
+ * register or deregister callbacks with the same state.
+ */
+class cancellation_state
+{
+#if FREETURES_HAS_THREADS
+    using mutex_type = std::mutex;
+#else
+    struct mutex_type
+    {
+        void lock() noexcept {}
+        void unlock() noexcept {}
+    };
+#endif
+
+    ref_count refs_;
+    mutex_type mutex_;
+    std::atomic<bool> is_cancelled_{false};
+    cancellation_callback* callbacks_ = nullptr;
+
+    cancellation_state() = default;
+    ~cancellation_state() = default;
+
+public:
+    /** @return A new state, with a single reference owned by the caller. */
+    static intrusive_ptr<cancellation_state> create()
+    {
+        return intrusive_ptr<cancellation_state>(new cancellation_state);
+    }
+
+    void add_ref() noexcept
+    {
+        refs_.increment();
+    }
+
+    void release() noexcept
+    {
+        if(refs_.decrement()) {
+            delete this;
+        }
+    }
+
+    bool is_cancelled() const noexcept
+    {
+        return is_cancelled_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Registers @p c to be invoked once cancellation is requested.
+     *
+     * @return False if cancellation has already been requested, in which case
+     * @p c is not registered and the operation should be cancelled right away.
+     */
+    bool add(cancellation_callback& c)
+    {
+        std::lock_guard<mutex_type> lock(mutex_);
+        if(is_cancelled()) {
+            return false;
+        }
+        c.prev_ = nullptr;
+        c.next_ = callbacks_;
+        if(callbacks_) {
+            callbacks_->prev_ = &c;
+        }
+        callbacks_ = &c;
+        c.registered_ = true;
+        return true;
+    }
+
+    /**
+     * Deregisters @p c, if it's still registered. If @p c is being invoked by
+     * another thread, waits until it returns.
+     */
+    void remove(cancellation_callback& c)
+    {
+        std::lock_guard<mutex_type> lock(mutex_);
+        if(c.registered_) {
+            unlink(c);
+        }
+    }
+
+    /**
+     * Marks the state as cancelled and invokes (and deregisters) the callbacks
+     * registered so far.
+     *
+     * @return False if cancellation had already been requested.
+     */
+    bool cancel()
+    {
+        std::lock_guard<mutex_type> lock(mutex_);
+        if(is_cancelled_.exchange(true, std::memory_order_acq_rel)) {
+            return false;
+        }
+        while(callbacks_) {
+            cancellation_callback* c = callbacks_;
+            unlink(*c);
+            c->func_(c);
+        }
+        return true;
+    }
+
+private:
+    void unlink(cancellation_callback& c) noexcept
+    {
+        if(c.prev_) {
+            c.prev_->next_ = c.next_;
+        } else {
+            callbacks_ = c.next_;
+        }
+        if(c.next_) {
+            c.next_->prev_ = c.prev_;
+        }
+        c.prev_ = c.next_ = nullptr;
+        c.registered_ = false;
+    }
+};
+
+} // detail
+} // ft
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef FREETURES_CONFIG_HPP
+#define FREETURES_CONFIG_HPP
+
+/**
+ * Whether futures may be completed, and schedulers run or posted to, from more
+ * than one thread. Defining it as 0 turns the synchronization that this needs
+ * (e.g. atomic reference counts and the locks of the promise pool) into plain
+ * operations, for single-threaded deployments that gain nothing from it.
+ */
+#ifndef FREETURES_HAS_THREADS
+# define FREETURES_HAS_THREADS 1
+#endif
+
+/**
+ * Whether the compiler supports C++20 coroutines, and thus `ft::task` and
+ * awaiting futures are available (see task.hpp).
+ */
+#ifndef FREETURES_HAS_COROUTINES
+# if defined(__cpp_impl_coroutine) && defined(__has_include)
+#  if __has_include(<coroutine>)
+#   define FREETURES_HAS_COROUTINES 1
+#  endif
+# endif
+#endif
+#ifndef FREETURES_HAS_COROUTINES
+# define FREETURES_HAS_COROUTINES 0
+#endif
+
+/**
+ * Whether exceptions are enabled. Without them (e.g. with -fno-exceptions),
+ * misuse of the library is reported to the fatal error handler (see error.hpp)
+ * instead of being thrown, and the errors of asynchronous operations travel
+ * only through the `std::error_code` channel of futures, which they do either
+ * way.
+ */
+#ifndef FREETURES_HAS_EXCEPTIONS
+# if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+#  define FREETURES_HAS_EXCEPTIONS 1
+# else
+#  define FREETURES_HAS_EXCEPTIONS 0
+# endif
+#endif
+
+/**
+ * Whether the reactor is backed by epoll (Linux), rather than by select, which
+ * is the fallback available wherever descriptors are. epoll registers each
+ * descriptor once instead of handing the kernel every descriptor on each wait,
+ * so its cost doesn't grow with the number of descriptors.
+ */
+#ifndef FREETURES_HAS_EPOLL
+# if defined(__linux__)
+#  define FREETURES_HAS_EPOLL 1
+# else
+#  define FREETURES_HAS_EPOLL 0
+# endif
+#endif
+
+/**
+ * Whether reactors are interrupted through an eventfd (Linux), rather than
+ * through a pipe.
+ */
+#ifndef FREETURES_HAS_EVENTFD
+# if defined(__linux__)
+#  define FREETURES_HAS_EVENTFD 1
+# else
+#  define FREETURES_HAS_EVENTFD 0
+# endif
+#endif
+
+/**
+ * Whether reactors wait for the scheduler's timers on a timerfd (Linux), armed
+ * with the earliest deadline, rather than with a timeout computed anew for
+ * each wait.
+ */
+#ifndef FREETURES_HAS_TIMERFD
+# if defined(__linux__)
+#  define FREETURES_HAS_TIMERFD 1
+# else
+#  define FREETURES_HAS_TIMERFD 0
+# endif
+#endif
+
+/**
+ * Whether the reactor submits reads and writes through io_uring, which
+ * completes them without a readiness round trip and batches the system calls
+ * of many operations into one. The kernel (5.19 or later) may still lack it,
+ * or forbid it, in which case the reactor falls back to epoll at run time.
+ * Requires FREETURES_HAS_EPOLL.
+ */
+#ifndef FREETURES_HAS_IO_URING
+# if FREETURES_HAS_EPOLL && defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#   define FREETURES_HAS_IO_URING 1
+#  endif
+# endif
+#endif
+#ifndef FREETURES_HAS_IO_URING
+# define FREETURES_HAS_IO_URING 0
+#endif
+
+#endif
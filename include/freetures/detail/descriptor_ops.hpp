@@ -0,0 +1,191 @@
+#ifndef FREETURES_DESCRIPTOR_OPS_HPP
+#define FREETURES_DESCRIPTOR_OPS_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <memory>
+#include <system_error>
+
+#include <unistd.h>
+
+#include "../promise.hpp"
+#include "cancellation_state.hpp"
+#include "reactor.hpp"
+#include "reactor_op.hpp"
+#include "ref_count.hpp"
+#include "scheduler.hpp"
+
+namespace ft {
+namespace detail {
+
+/**
+ * The part of reading from and writing to a descriptor that doesn't depend on
+ * the direction: fulfilling the promise of the number of bytes transferred,
+ * or cancelling it if the cancellation of the operation's token is requested
+ * while the operation waits in the reactor.
+ */
+class descriptor_op : public reactor_op, private cancellation_callback
+{
+protected:
+    scheduler& scheduler_;
+    promise<std::size_t> promise_;
+    int descriptor_;
+
+private:
+    // Where the operation waits, for the cancellation callback to withdraw it.
+    op_type type_ = read_op;
+    reactor::per_descriptor_data data_ = nullptr;
+    // Set while the cancellation callback is registered.
+    intrusive_ptr<cancellation_state> cancellation_;
+
+protected:
+    descriptor_op(scheduler& s, int descriptor, const void* data, std::size_t size,
+            perform_func perform, scheduler_op::func_type complete)
+        : reactor_op(perform, complete)
+        , cancellation_callback(&descriptor_op::do_cancel)
+        , scheduler_(s)
+        , promise_(s)
+        , descriptor_(descriptor)
+    {
+        buffer_ = const_cast<void*>(data);
+        buffer_size_ = size;
+    }
+
+    ~descriptor_op() = default;
+
+    // Interprets the result of a read or write call. Returns false if the
+    // call would block.
+    bool set_result(ssize_t result) noexcept
+    {
+        if(result >= 0) {
+            bytes_transferred_ = static_cast<std::size_t>(result);
+            return true;
+        }
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return false;
+        }
+        ec_ = std::error_code(errno, std::system_category());
+        return true;
+    }
+
+    // Fulfills the promise, which the operation must no longer touch after.
+    void fulfill()
+    {
+        if(cancellation_) {
+            // Waits for the callback, if it's being invoked by another thread,
+            // which then finds nothing to withdraw.
+            cancellation_->remove(*this);
+        }
+        if(ec_ == std::errc::operation_canceled) {
+            promise_.set_cancelled();
+        } else if(ec_) {
+            promise_.set_error(ec_);
+        } else {
+            promise_.set_value(std::size_t(bytes_transferred_));
+        }
+        scheduler_.post_ready_promise(std::move(promise_));
+    }
+
+public:
+    future<std::size_t> get_future()
+    {
+        return promise_.get_future();
+    }
+
+    /**
+     * Has the operation, which is about to be started as an operation of kind
+     * @p type on the descriptor of @p data, withdrawn from the reactor once
+     * @p cancellation (if any) is requested.
+     *
+     * @return False if cancellation has already been requested, in which case
+     * the operation is to be completed as cancelled rather than started.
+     */
+    bool watch(op_type type, reactor::per_descriptor_data data,
+            intrusive_ptr<cancellation_state> cancellation)
+    {
+        type_ = type;
+        data_ = data;
+        if(cancellation) {
+            if(!cancellation->add(*this)) {
+                return false;
+            }
+            cancellation_ = std::move(cancellation);
+        }
+        return true;
+    }
+
+private:
+    static void do_cancel(cancellation_callback* c)
+    {
+        auto* op = static_cast<descriptor_op*>(c);
+        // If the operation can't be withdrawn, it's either being completed by
+        // another thread, or it's in the kernel's hands, which completes it as
+        // cancelled, if it can.
+        scheduler& s = op->scheduler_;
+        if(s.get_reactor().cancel_op(op->type_, op->data_, op)) {
+            // The cancellation has already deregistered the callback.
+            op->cancellation_.reset();
+            op->complete();
+            s.work_finished();
+        }
+    }
+};
+
+/** Reads up to a number of bytes from a descriptor. */
+class descriptor_read_op final : public descriptor_op
+{
+public:
+    descriptor_read_op(scheduler& s, int descriptor, void* data, std::size_t size)
+        : descriptor_op(s, descriptor, data, size, &descriptor_read_op::do_perform,
+                &descriptor_read_op::do_complete)
+    {}
+
+private:
+    static bool do_perform(reactor_op* base)
+    {
+        auto* op = static_cast<descriptor_read_op*>(base);
+        ssize_t result;
+        do {
+            result = ::read(op->descriptor_, op->buffer_, op->buffer_size_);
+        } while(result < 0 && errno == EINTR);
+        return op->set_result(result);
+    }
+
+    static void do_complete(scheduler_op* base)
+    {
+        std::unique_ptr<descriptor_read_op> op(static_cast<descriptor_read_op*>(base));
+        op->fulfill();
+    }
+};
+
+/** Writes up to a number of bytes to a descriptor. */
+class descriptor_write_op final : public descriptor_op
+{
+public:
+    descriptor_write_op(scheduler& s, int descriptor, const void* data, std::size_t size)
+        : descriptor_op(s, descriptor, data, size, &descriptor_write_op::do_perform,
+                &descriptor_write_op::do_complete)
+    {}
+
+private:
+    static bool do_perform(reactor_op* base)
+    {
+        auto* op = static_cast<descriptor_write_op*>(base);
+        ssize_t result;
+        do {
+            result = ::write(op->descriptor_, op->buffer_, op->buffer_size_);
+        } while(result < 0 && errno == EINTR);
+        return op->set_result(result);
+    }
+
+    static void do_complete(scheduler_op* base)
+    {
+        std::unique_ptr<descriptor_write_op> op(static_cast<descriptor_write_op*>(base));
+        op->fulfill();
+    }
+};
+
+} // detail
+} // ft
+
+#endif
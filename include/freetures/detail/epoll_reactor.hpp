@@ -0,0 +1,234 @@
+#ifndef FREETURES_EPOLL_REACTOR_HPP
+#define FREETURES_EPOLL_REACTOR_HPP
+
+#include "config.hpp"
+
+#if FREETURES_HAS_EPOLL
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <system_error>
+
+#include <sys/epoll.h>
+
+#include "../time.hpp"
+#include "op_queue.hpp"
+#include "reactor_op.hpp"
+#include "interrupter.hpp"
+#include "timerfd_timer.hpp"
+
+namespace ft {
+namespace detail {
+
+class scheduler;
+
+/**
+ * A reactor backed by epoll.
+ *
+ * Each descriptor is registered with epoll exactly once, for all kinds of
+ * readiness at the same time and in edge-triggered mode, so starting and
+ * completing operations never touches the registration: the kernel reports a
+ * descriptor only when it becomes ready anew, not on every wait for as long
+ * as it stays ready. Since an edge that arrives while no operation is waiting
+ * is not reported again, the descriptor remembers it, and the next operation
+ * started on it is attempted right away.
+ *
+ * The operations of each descriptor wait in a FIFO queue per kind of
+ * readiness, and on an event the reactor performs as many of them as the
+ * descriptor allows. Operations may be started by any thread; the reactor is
+ * run by one thread at a time (see @ref scheduler::poll_reactor).
+ */
+class epoll_reactor
+{
+#if FREETURES_HAS_THREADS
+    using mutex_type = std::mutex;
+#else
+    struct mutex_type
+    {
+        void lock() noexcept {}
+        void unlock() noexcept {}
+    };
+#endif
+
+public:
+    using op_type = reactor_op::op_type;
+
+    /** The reactor's state of a registered descriptor. */
+    class descriptor_state
+    {
+        friend class epoll_reactor;
+
+        mutex_type mutex_;
+        op_queue<reactor_op> op_queues_[reactor_op::max_ops];
+        int descriptor_;
+        // The kinds of readiness of which the last edge has not been used up
+        // by an operation that would block.
+        std::uint32_t ready_events_ = 0;
+        // Set once the descriptor is deregistered.
+        bool shutdown_ = false;
+        // Links deregistered states until they can be freed.
+        descriptor_state* next_free_ = nullptr;
+        // Links the registered states.
+        descriptor_state* prev_ = nullptr;
+        descriptor_state* next_ = nullptr;
+
+        explicit descriptor_state(int descriptor) : descriptor_(descriptor) {}
+    };
+
+    /** What an I/O object keeps of its registration. */
+    using per_descriptor_data = descriptor_state*;
+
+private:
+    // The maximum number of events reaped by a single wait.
+    static constexpr int max_events = 128;
+
+    scheduler& scheduler_;
+    int epoll_descriptor_;
+
+    // Wakes a thread blocked in epoll_wait. Its read descriptor is registered
+    // in level-triggered mode, as it is drained after each interrupt.
+    interrupter interrupter_;
+#if FREETURES_HAS_TIMERFD
+    // Wakes a thread blocked in epoll_wait when the next timer is due, also
+    // registered in level-triggered mode.
+    timerfd_timer timer_;
+#endif
+
+    // Deregistered descriptor states. The thread running the reactor may
+    // still hold events for them, so they're only freed at the start of the
+    // next run, by which time those events have been dispatched.
+    mutex_type free_mutex_;
+    descriptor_state* free_states_ = nullptr;
+
+    // The registered states, so that their operations can be aborted when
+    // the scheduler is destroyed.
+    mutex_type registry_mutex_;
+    descriptor_state* registered_ = nullptr;
+
+public:
+    explicit epoll_reactor(scheduler& s);
+    ~epoll_reactor();
+
+    epoll_reactor(const epoll_reactor&) = delete;
+    epoll_reactor& operator=(const epoll_reactor&) = delete;
+
+    /**
+     * Registers @p descriptor, which must be in non-blocking mode, with the
+     * reactor, and stores the state of the registration in @p data.
+     */
+    std::error_code register_descriptor(int descriptor, per_descriptor_data& data);
+
+    /**
+     * Removes the registration of a descriptor. Its pending operations are
+     * aborted with `std::errc::operation_canceled`. Must be called before the
+     * descriptor is closed.
+     */
+    void deregister_descriptor(per_descriptor_data& data);
+
+    /**
+     * Buffers are not registered with epoll: they're only of use to a
+     * completion-based backend (see uring_reactor).
+     */
+    std::error_code register_buffer(void*, std::size_t)
+    {
+        return std::make_error_code(std::errc::operation_not_supported);
+    }
+
+    /**
+     * Starts operation @p op of kind @p type on the descriptor of @p data,
+     * which either completes it right away, if the descriptor is known to be
+     * ready, or queues it until it is. The reactor owns the operation until
+     * it completes, and keeps the scheduler from running out of work while it
+     * waits.
+     */
+    void start_op(op_type type, per_descriptor_data& data, reactor_op* op);
+
+    /**
+     * Aborts the pending operations of a descriptor with
+     * `std::errc::operation_canceled`.
+     */
+    void cancel_ops(per_descriptor_data& data);
+
+    /**
+     * Withdraws operation @p op of kind @p type from the descriptor of @p
+     * data, if it's still queued. May be called by any thread, as long as the
+     * operation hasn't been completed.
+     *
+     * @return True if the operation was withdrawn, in which case it has been
+     * aborted with `std::errc::operation_canceled`, and the caller completes
+     * it, then calls `work_finished` on the scheduler. Otherwise it completes
+     * as usual, or, if it hasn't been started yet, is aborted by @ref
+     * start_op.
+     */
+    bool cancel_op(op_type type, per_descriptor_data& data, reactor_op* op);
+
+    /**
+     * Aborts the pending operations of all registered descriptors with
+     * `std::errc::operation_canceled`, as the scheduler is destroyed.
+     */
+    void abort_all_ops();
+
+    /** Whether any operation is still pending, e.g. after @ref abort_all_ops. */
+    bool has_pending_ops();
+
+    /** Makes a thread blocked in @ref run return. May be called by any thread. */
+    void interrupt()
+    {
+        interrupter_.interrupt();
+    }
+
+    /**
+     * Makes @ref run return by @p expiry, or never if it's `time_point::max()`,
+     * without a timeout, if the reactor has a timerfd (see
+     * FREETURES_HAS_TIMERFD). Returns false otherwise, in which case the
+     * caller has to pass run a timeout. Only called by the thread running the
+     * reactor.
+     */
+    bool arm_timer(time_point expiry)
+    {
+#if FREETURES_HAS_TIMERFD
+        timer_.arm(expiry);
+        return true;
+#else
+        (void)expiry;
+        return false;
+#endif
+    }
+
+    /**
+     * @brief Waits for descriptor events and dispatches them.
+     *
+     * @param timeout The longest time to wait for an event, or until @ref
+     * interrupt is called. If zero, only checks for events that already
+     * occurred; if `duration::max()`, waits indefinitely.
+     */
+    void run(duration timeout);
+
+    void stop()
+    {
+    }
+
+private:
+    // Performs the operations that event @p events makes possible, and
+    // collects the ones that are done in @p completed.
+    void perform_io(descriptor_state& state, std::uint32_t events,
+            op_queue<reactor_op>& completed);
+
+    // Completes operations that have been waiting in the reactor.
+    void complete_ops(op_queue<reactor_op>& ops);
+
+    void free_descriptor_states();
+
+    // The events that make operations of kind @p type possible.
+    static std::uint32_t op_events(int type) noexcept;
+
+    static int to_msec(duration timeout) noexcept;
+};
+
+} // detail
+} // ft
+
+#endif // FREETURES_HAS_EPOLL
+
+#endif
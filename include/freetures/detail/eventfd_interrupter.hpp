@@ -0,0 +1,95 @@
+#ifndef FREETURES_EVENTFD_INTERRUPTER_HPP
+#define FREETURES_EVENTFD_INTERRUPTER_HPP
+
+#include "config.hpp"
+
+#if FREETURES_HAS_EVENTFD
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "../error.hpp"
+
+namespace ft {
+namespace detail {
+
+/**
+ * Makes a blocking wait for descriptors return by signalling an eventfd that
+ * is among the descriptors waited for.
+ *
+ * Unlike a pipe, an eventfd is a single descriptor, is drained by a single
+ * read of its counter, and never fills up. On top of that, the interrupter
+ * remembers whether it's signalled: once a wakeup is pending, further
+ * interrupts don't write to the eventfd, so a burst of them costs a single
+ * system call until the reactor wakes up and resets it. (Interrupts that find
+ * the reactor awake in the first place are already filtered out by the
+ * scheduler, see scheduler::interrupt_blocked_reactor.)
+ */
+class eventfd_interrupter
+{
+    int descriptor_ = -1;
+    // Set by the interrupt that signals the eventfd, and cleared once the
+    // reactor drains it.
+    std::atomic<bool> signalled_{false};
+
+public:
+    eventfd_interrupter()
+        : descriptor_(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+    {
+        if(descriptor_ == -1) {
+            throw_error(std::error_code(errno, std::system_category()),
+                    "eventfd_interrupter");
+        }
+    }
+
+    eventfd_interrupter(const eventfd_interrupter&) = delete;
+    eventfd_interrupter& operator=(const eventfd_interrupter&) = delete;
+
+    ~eventfd_interrupter()
+    {
+        ::close(descriptor_);
+    }
+
+    /**
+     * Makes the read descriptor readable, unless it already is. May be called
+     * by any thread.
+     */
+    void interrupt()
+    {
+        if(signalled_.load(std::memory_order_acquire)
+                || signalled_.exchange(true, std::memory_order_acq_rel)) {
+            return;
+        }
+        const std::uint64_t one = 1;
+        const auto result = ::write(descriptor_, &one, sizeof(one));
+        (void)result;
+    }
+
+    /**
+     * Drains the eventfd so that the read descriptor is no longer readable.
+     * Called by the reactor when it wakes up: an interrupt that comes after
+     * the drain but before the flag is cleared finds the reactor awake, which
+     * is all it wanted.
+     */
+    void reset()
+    {
+        std::uint64_t count;
+        const auto result = ::read(descriptor_, &count, sizeof(count));
+        (void)result;
+        signalled_.store(false, std::memory_order_release);
+    }
+
+    int read_descriptor() { return descriptor_; }
+};
+
+} // detail
+} // ft
+
+#endif // FREETURES_HAS_EVENTFD
+
+#endif
@@ -0,0 +1,325 @@
+#ifndef FREETURES_EPOLL_REACTOR_IPP
+#define FREETURES_EPOLL_REACTOR_IPP
+
+#include "../config.hpp"
+
+#if FREETURES_HAS_EPOLL
+
+#include <cerrno>
+#include <climits>
+#include <mutex>
+#include <system_error>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "../../error.hpp"
+#include "../epoll_reactor.hpp"
+#include "../scheduler.hpp"
+
+namespace ft {
+namespace detail {
+
+inline epoll_reactor::epoll_reactor(scheduler& s)
+    : scheduler_(s)
+    , epoll_descriptor_(::epoll_create1(EPOLL_CLOEXEC))
+{
+    if(epoll_descriptor_ == -1) {
+        throw_error(std::error_code(errno, std::system_category()), "epoll_create1");
+    }
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &interrupter_;
+    int result = ::epoll_ctl(epoll_descriptor_, EPOLL_CTL_ADD,
+            interrupter_.read_descriptor(), &ev);
+#if FREETURES_HAS_TIMERFD
+    if(result == 0) {
+        ev.data.ptr = &timer_;
+        result = ::epoll_ctl(epoll_descriptor_, EPOLL_CTL_ADD, timer_.descriptor(), &ev);
+    }
+#endif
+    if(result != 0) {
+        const std::error_code error(errno, std::system_category());
+        ::close(epoll_descriptor_);
+        throw_error(error, "epoll_ctl");
+    }
+}
+
+inline epoll_reactor::~epoll_reactor()
+{
+    free_descriptor_states();
+    ::close(epoll_descriptor_);
+}
+
+inline std::error_code epoll_reactor::register_descriptor(
+        int descriptor, per_descriptor_data& data)
+{
+    auto* state = new descriptor_state(descriptor);
+    // If the descriptor is already ready, adding it reports the edge right
+    // away, so the state need not assume anything about it.
+    epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = state;
+    if(::epoll_ctl(epoll_descriptor_, EPOLL_CTL_ADD, descriptor, &ev) != 0) {
+        const std::error_code error(errno, std::system_category());
+        delete state;
+        return error;
+    }
+    {
+        std::lock_guard<mutex_type> lock(registry_mutex_);
+        state->next_ = registered_;
+        if(registered_) {
+            registered_->prev_ = state;
+        }
+        registered_ = state;
+    }
+    data = state;
+    return {};
+}
+
+inline void epoll_reactor::deregister_descriptor(per_descriptor_data& data)
+{
+    descriptor_state* state = data;
+    if(state == nullptr) {
+        return;
+    }
+    data = nullptr;
+    {
+        std::lock_guard<mutex_type> lock(registry_mutex_);
+        if(state->prev_) {
+            state->prev_->next_ = state->next_;
+        } else {
+            registered_ = state->next_;
+        }
+        if(state->next_) {
+            state->next_->prev_ = state->prev_;
+        }
+    }
+
+    op_queue<reactor_op> aborted;
+    {
+        std::lock_guard<mutex_type> lock(state->mutex_);
+        state->shutdown_ = true;
+        epoll_event ev = {};
+        ::epoll_ctl(epoll_descriptor_, EPOLL_CTL_DEL, state->descriptor_, &ev);
+        for(auto& ops : state->op_queues_) {
+            while(reactor_op* op = ops.pop()) {
+                op->ec_ = std::make_error_code(std::errc::operation_canceled);
+                aborted.push(op);
+            }
+        }
+    }
+    // Completing the aborted operations waits for their cancellation
+    // callbacks, which may still refer to the state, to return.
+    complete_ops(aborted);
+    {
+        std::lock_guard<mutex_type> lock(free_mutex_);
+        state->next_free_ = free_states_;
+        free_states_ = state;
+    }
+}
+
+inline void epoll_reactor::start_op(op_type type,
+        per_descriptor_data& data, reactor_op* op)
+{
+    descriptor_state& state = *data;
+    std::unique_lock<mutex_type> lock(state.mutex_);
+    if(op->cancelled_) {
+        lock.unlock();
+        op->ec_ = std::make_error_code(std::errc::operation_canceled);
+        op->complete();
+        return;
+    }
+    op_queue<reactor_op>& ops = state.op_queues_[type];
+    // Operations queued before this one go first. Otherwise, if the last edge
+    // hasn't been used up, the descriptor may be ready, and as no new edge
+    // may come, the operation has to be attempted now.
+    if(ops.empty() && (state.ready_events_ & op_events(type))) {
+        if(op->perform()) {
+            lock.unlock();
+            op->complete();
+            return;
+        }
+        state.ready_events_ &= ~op_events(type);
+    }
+    ops.push(op);
+    scheduler_.work_started();
+}
+
+inline void epoll_reactor::cancel_ops(per_descriptor_data& data)
+{
+    descriptor_state& state = *data;
+    op_queue<reactor_op> aborted;
+    {
+        std::lock_guard<mutex_type> lock(state.mutex_);
+        for(auto& ops : state.op_queues_) {
+            while(reactor_op* op = ops.pop()) {
+                op->ec_ = std::make_error_code(std::errc::operation_canceled);
+                aborted.push(op);
+            }
+        }
+    }
+    complete_ops(aborted);
+}
+
+inline bool epoll_reactor::cancel_op(op_type type,
+        per_descriptor_data& data, reactor_op* op)
+{
+    std::lock_guard<mutex_type> lock(data->mutex_);
+    op->cancelled_ = true;
+    if(!data->op_queues_[type].remove(op)) {
+        return false;
+    }
+    op->ec_ = std::make_error_code(std::errc::operation_canceled);
+    return true;
+}
+
+inline void epoll_reactor::run(duration timeout)
+{
+    free_descriptor_states();
+
+    epoll_event events[max_events];
+    const int n = ::epoll_wait(epoll_descriptor_, events, max_events, to_msec(timeout));
+    if(n <= 0) {
+        // Timed out, or interrupted by a signal.
+        return;
+    }
+
+    op_queue<reactor_op> completed;
+    for(int i = 0; i < n; ++i) {
+        void* ptr = events[i].data.ptr;
+        if(ptr == &interrupter_) {
+            interrupter_.reset();
+            continue;
+        }
+#if FREETURES_HAS_TIMERFD
+        if(ptr == &timer_) {
+            // The scheduler collects the due timers once run returns.
+            timer_.reset();
+            continue;
+        }
+#endif
+        perform_io(*static_cast<descriptor_state*>(ptr), events[i].events, completed);
+    }
+    complete_ops(completed);
+}
+
+inline void epoll_reactor::perform_io(descriptor_state& state,
+        std::uint32_t events, op_queue<reactor_op>& completed)
+{
+    // Errors and hangups are reported to every kind of operation, which then
+    // learns about them from its system call.
+    if(events & (EPOLLERR | EPOLLHUP)) {
+        events |= EPOLLIN | EPOLLOUT | EPOLLPRI;
+    }
+    if(events & EPOLLRDHUP) {
+        events |= EPOLLIN;
+    }
+
+    std::lock_guard<mutex_type> lock(state.mutex_);
+    if(state.shutdown_) {
+        return;
+    }
+    // Out-of-band data first, as it may be urgent.
+    for(int type = reactor_op::max_ops - 1; type >= 0; --type) {
+        const std::uint32_t event = op_events(type);
+        if((events & event) == 0) {
+            continue;
+        }
+        state.ready_events_ |= event;
+        op_queue<reactor_op>& ops = state.op_queues_[type];
+        while(reactor_op* op = ops.front()) {
+            if(!op->perform()) {
+                // The edge is used up: wait for the next one.
+                state.ready_events_ &= ~event;
+                break;
+            }
+            completed.push(ops.pop());
+        }
+    }
+}
+
+inline void epoll_reactor::abort_all_ops()
+{
+    op_queue<reactor_op> aborted;
+    {
+        std::lock_guard<mutex_type> registry_lock(registry_mutex_);
+        for(descriptor_state* state = registered_; state; state = state->next_) {
+            std::lock_guard<mutex_type> lock(state->mutex_);
+            for(auto& ops : state->op_queues_) {
+                while(reactor_op* op = ops.pop()) {
+                    op->ec_ = std::make_error_code(std::errc::operation_canceled);
+                    aborted.push(op);
+                }
+            }
+        }
+    }
+    complete_ops(aborted);
+}
+
+inline bool epoll_reactor::has_pending_ops()
+{
+    std::lock_guard<mutex_type> registry_lock(registry_mutex_);
+    for(descriptor_state* state = registered_; state; state = state->next_) {
+        std::lock_guard<mutex_type> lock(state->mutex_);
+        for(auto& ops : state->op_queues_) {
+            if(!ops.empty()) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+inline void epoll_reactor::complete_ops(op_queue<reactor_op>& ops)
+{
+    while(reactor_op* op = ops.pop()) {
+        op->complete();
+        scheduler_.work_finished();
+    }
+}
+
+inline void epoll_reactor::free_descriptor_states()
+{
+    descriptor_state* state;
+    {
+        std::lock_guard<mutex_type> lock(free_mutex_);
+        state = free_states_;
+        free_states_ = nullptr;
+    }
+    while(state) {
+        descriptor_state* next = state->next_free_;
+        delete state;
+        state = next;
+    }
+}
+
+inline std::uint32_t epoll_reactor::op_events(int type) noexcept
+{
+    switch(type) {
+    case reactor_op::read_op: return EPOLLIN;
+    case reactor_op::write_op: return EPOLLOUT;
+    default: return EPOLLPRI;
+    }
+}
+
+inline int epoll_reactor::to_msec(duration timeout) noexcept
+{
+    if(timeout == duration::max()) {
+        return -1;
+    }
+    // Round up, so that we don't wake up just before a timer is due only to
+    // go back to sleep for less than a millisecond.
+    auto ms = duration_cast<milliseconds>(timeout);
+    if(ms < timeout) {
+        ++ms;
+    }
+    return ms.count() > INT_MAX ? INT_MAX : static_cast<int>(ms.count());
+}
+
+} // detail
+} // ft
+
+#endif // FREETURES_HAS_EPOLL
+
+#endif
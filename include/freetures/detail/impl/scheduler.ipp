@@ -0,0 +1,351 @@
+#ifndef FREETURES_SCHEDULER_IMPL_IPP
+#define FREETURES_SCHEDULER_IMPL_IPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "../../future.hpp"
+#include "../../promise.hpp"
+#include "../cancellation_state.hpp"
+#include "../ref_count.hpp"
+#include "../scheduler.hpp"
+#include "../timer.hpp"
+#include "../timer_wheel.hpp"
+
+namespace ft {
+namespace detail {
+
+/**
+ * Fulfills a void promise once its timer expires, or cancels it if its
+ * cancellation is requested first.
+ */
+class wait_op final : public timer_op, private cancellation_callback
+{
+    // Withdraws the timer on the scheduler's thread when cancellation is
+    // requested by a thread that may not touch the timer wheel.
+    class withdraw_op final : public scheduler_op
+    {
+    public:
+        wait_op* const w;
+
+        explicit withdraw_op(wait_op* op)
+            : scheduler_op(&wait_op::do_withdraw)
+            , w(op)
+        {}
+    };
+
+    scheduler& scheduler_;
+    promise<null_tag> promise_;
+    intrusive_ptr<cancellation_state> cancellation_;
+    withdraw_op withdraw_op_;
+    // Set while withdraw_op_ is posted, in which case whichever of it and the
+    // expiry comes last frees the operation. Only touched by the scheduler's
+    // thread, but for the cancellation callback that posts withdraw_op_, which
+    // the expiry waits for by deregistering the callback.
+    bool withdrawing_ = false;
+    bool expired_ = false;
+
+public:
+    explicit wait_op(scheduler& s)
+        : timer_op(&wait_op::do_complete)
+        , cancellation_callback(&wait_op::do_cancel)
+        , scheduler_(s)
+        , promise_(s)
+        , withdraw_op_(this)
+    {}
+
+    future<null_tag> get_future()
+    {
+        return promise_.get_future();
+    }
+
+    /**
+     * Arms the timer, unless @p cancellation has already been requested, in
+     * which case the promise is cancelled right away. Either way, the
+     * operation owns itself from here on.
+     */
+    void start(time_point expiry, intrusive_ptr<cancellation_state> cancellation)
+    {
+        if(cancellation) {
+            if(!cancellation->add(*this)) {
+                complete(false);
+                return;
+            }
+            cancellation_ = std::move(cancellation);
+        }
+        scheduler_.start_timer(*this, expiry);
+    }
+
+private:
+    void complete(bool expired)
+    {
+        std::unique_ptr<wait_op> self(this);
+        fulfil(expired);
+    }
+
+    void fulfil(bool expired)
+    {
+        if(expired) {
+            promise_.set_value(null_tag());
+        } else {
+            promise_.set_cancelled();
+        }
+        scheduler_.post_ready_promise(std::move(promise_));
+    }
+
+    static void do_complete(scheduler_op* op)
+    {
+        auto* w = static_cast<wait_op*>(op);
+        // A wait that is pending when the scheduler is destroyed is cancelled.
+        bool expired = !w->scheduler_.is_shutting_down();
+        if(w->cancellation_) {
+            // Cancellation may have been requested after the timer expired,
+            // or by a thread that couldn't withdraw the timer.
+            w->cancellation_->remove(*w);
+            expired = expired && !w->cancellation_->is_cancelled();
+        }
+        if(w->withdrawing_) {
+            w->fulfil(expired);
+            w->expired_ = true;
+            return;
+        }
+        w->complete(expired);
+    }
+
+    static void do_cancel(cancellation_callback* c)
+    {
+        auto* w = static_cast<wait_op*>(c);
+        // The timer wheel of a scheduler run by a single thread may only be
+        // touched by that thread, so other threads have it withdraw the timer.
+        // If the timer can't be withdrawn, it's already on its way to
+        // do_complete, which takes care of the cancellation.
+        scheduler& s = w->scheduler_;
+        if(!s.is_concurrent() && !s.running_in_this_thread()) {
+            w->withdrawing_ = true;
+            s.post_ready_op(&w->withdraw_op_);
+        } else if(s.cancel_timer(*w)) {
+            w->complete(false);
+        }
+    }
+
+    static void do_withdraw(scheduler_op* op)
+    {
+        wait_op* w = static_cast<withdraw_op*>(op)->w;
+        w->withdrawing_ = false;
+        if(w->expired_) {
+            delete w;
+        } else if(w->scheduler_.cancel_timer(*w)) {
+            w->complete(false);
+        }
+    }
+};
+
+inline future<null_tag> scheduler::wait(duration delay,
+        intrusive_ptr<cancellation_state> cancellation)
+{
+    auto* op = new wait_op(*this);
+    auto future = op->get_future();
+    op->start(clock::now() + delay, std::move(cancellation));
+    return future;
+}
+
+template<typename F, typename R, typename>
+future<R> scheduler::defer(F&& f, duration delay,
+        intrusive_ptr<cancellation_state> cancellation)
+{
+    // The continuation is attached before the timer is armed, so that it
+    // can't race with the expiry when deferring from another thread.
+    auto* op = new wait_op(*this);
+    auto future = op->get_future().then(
+        [f = std::forward<F>(f)](null_tag) mutable { return f(); });
+    op->start(clock::now() + delay, std::move(cancellation));
+    return future;
+}
+
+/**
+ * A repetition started by @ref scheduler::repeat, which runs until its
+ * cancellation is requested or its scheduler is destroyed.
+ *
+ * The timer may only be touched by the thread running the scheduler (for a
+ * scheduler run by a single thread), and by one thread at a time anyway, so
+ * cancellation requested elsewhere merely marks the repetition stopped. The
+ * next expiry then frees it instead of invoking the function.
+ */
+class repeat_op final : private cancellation_callback
+{
+    friend class scheduler;
+
+    scheduler& scheduler_;
+    timer timer_;
+    intrusive_ptr<cancellation_state> cancellation_;
+    std::atomic<bool> stopped_{false};
+    // The links of the scheduler's list of repetitions, guarded by its
+    // repeats_mutex_.
+    repeat_op* prev_ = nullptr;
+    repeat_op* next_ = nullptr;
+
+public:
+    explicit repeat_op(scheduler& s)
+        : cancellation_callback(&repeat_op::do_cancel)
+        , scheduler_(s)
+        , timer_(s)
+    {}
+
+    /**
+     * Starts repeating @p f. The operation owns itself from here on, or
+     * rather, the scheduler owns it.
+     */
+    template<typename F>
+    void start(F&& f, duration period, catch_up policy,
+            intrusive_ptr<cancellation_state> cancellation)
+    {
+        if(cancellation && cancellation->is_cancelled()) {
+            delete this;
+            return;
+        }
+        scheduler_.add_repeat(*this);
+        timer_.repeat([this, f = std::forward<F>(f)](std::size_t missed) mutable {
+            if(stopped_.load(std::memory_order_acquire)) {
+                destroy();
+                return;
+            }
+            // Nothing may be touched after this, as f may have stopped us.
+            invoke(f, missed, 0);
+        }, period, policy);
+        // The cancellation is registered after the timer is armed, so that a
+        // callback can't touch the timer while it's being armed.
+        if(cancellation) {
+            cancellation_ = std::move(cancellation);
+            if(!cancellation_->add(*this)) {
+                cancellation_.reset();
+                stop();
+            }
+        }
+    }
+
+private:
+    template<typename F>
+    static auto invoke(F& f, std::size_t missed, int) -> decltype(f(missed), void())
+    {
+        f(missed);
+    }
+
+    template<typename F>
+    static void invoke(F& f, std::size_t, long)
+    {
+        f();
+    }
+
+    void stop()
+    {
+        stopped_.store(true, std::memory_order_release);
+        if(!scheduler_.is_concurrent() && scheduler_.running_in_this_thread()) {
+            destroy();
+        }
+    }
+
+    /** Cancels the timer and frees the operation. */
+    void destroy()
+    {
+        if(cancellation_) {
+            cancellation_->remove(*this);
+        }
+        scheduler_.remove_repeat(*this);
+        // The timer copes with being destroyed by its own handler.
+        delete this;
+    }
+
+    static void do_cancel(cancellation_callback* c)
+    {
+        auto* r = static_cast<repeat_op*>(c);
+        // The callback is already deregistered, and is still running.
+        if(!r->scheduler_.is_concurrent() && r->scheduler_.running_in_this_thread()) {
+            r->cancellation_.reset();
+        }
+        r->stop();
+    }
+};
+
+inline scheduler::~scheduler()
+{
+    shutting_down_ = true;
+    while(repeats_) {
+        repeats_->destroy();
+    }
+
+    // Executing an operation now drops or cancels it, which may abandon more
+    // promises, and so make more operations ready, until there are none left.
+    for(;;) {
+        reactor_.abort_all_ops();
+
+        op_queue<scheduler_op> ops;
+        {
+            auto lock = lock_timers();
+            op_queue<timer_op> injected;
+            injected_timers_.pop_all(injected);
+            while(timer_op* t = injected.pop()) {
+                ops.push(t);
+            }
+            timers_.remove_all(ops);
+        }
+        ops.push(ready_ops_);
+        ops.push(injected_batch_);
+        injected_ops_.pop_all(ops);
+        for(std::size_t i = 0; workers_ && i < concurrency_hint_; ++i) {
+            while(scheduler_op* op = workers_[i].ops.steal()) {
+                ops.push(op);
+            }
+        }
+
+        if(ops.empty()) {
+            if(!reactor_.has_pending_ops()) {
+                break;
+            }
+            // Wait for the kernel to give back the operations it holds.
+            reactor_.run(milliseconds(10));
+            continue;
+        }
+        while(scheduler_op* op = ops.pop()) {
+            op->complete();
+        }
+    }
+}
+
+inline void scheduler::add_repeat(repeat_op& r)
+{
+    std::lock_guard<std::mutex> lock(repeats_mutex_);
+    r.next_ = repeats_;
+    if(repeats_) {
+        repeats_->prev_ = &r;
+    }
+    repeats_ = &r;
+}
+
+inline void scheduler::remove_repeat(repeat_op& r)
+{
+    std::lock_guard<std::mutex> lock(repeats_mutex_);
+    if(r.prev_) {
+        r.prev_->next_ = r.next_;
+    } else {
+        repeats_ = r.next_;
+    }
+    if(r.next_) {
+        r.next_->prev_ = r.prev_;
+    }
+}
+
+template<typename F, typename>
+void scheduler::repeat(F&& f, duration frequency, catch_up policy,
+        intrusive_ptr<cancellation_state> cancellation)
+{
+    (new repeat_op(*this))->start(std::forward<F>(f), frequency, policy,
+            std::move(cancellation));
+}
+
+} // detail
+} // ft
+
+#endif
@@ -0,0 +1,376 @@
+#ifndef FREETURES_SELECT_REACTOR_IPP
+#define FREETURES_SELECT_REACTOR_IPP
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <system_error>
+
+#include <sys/select.h>
+#include <sys/uio.h>
+
+#include "../scheduler.hpp"
+#include "../select_reactor.hpp"
+
+namespace ft {
+namespace detail {
+
+inline select_reactor::select_reactor(scheduler& s)
+    : scheduler_(s)
+{
+    for(auto& set : master_sets_) {
+        FD_ZERO(&set);
+    }
+    max_descriptor_ = -1;
+    add_interest(interrupter_.read_descriptor(), reactor_op::read_op);
+#if FREETURES_HAS_TIMERFD
+    add_interest(timer_.descriptor(), reactor_op::read_op);
+#endif
+}
+
+inline std::error_code select_reactor::register_descriptor(
+        int descriptor, per_descriptor_data& data)
+{
+    if(descriptor < 0 || descriptor >= FD_SETSIZE) {
+        // It could not be put in an fd_set.
+        return std::make_error_code(std::errc::value_too_large);
+    }
+    auto* state = new descriptor_data(descriptor);
+    {
+        std::lock_guard<mutex_type> lock(mutex_);
+        state->next_ = descriptors_;
+        if(descriptors_) {
+            descriptors_->prev_ = state;
+        }
+        descriptors_ = state;
+    }
+    data = state;
+    return {};
+}
+
+inline void select_reactor::deregister_descriptor(per_descriptor_data& data)
+{
+    descriptor_data* state = data;
+    if(state == nullptr) {
+        return;
+    }
+    data = nullptr;
+
+    op_queue<reactor_op> aborted;
+    {
+        // Events are only ever dispatched to registered descriptors, under the
+        // lock, so nothing refers to the state once it's unlinked.
+        std::lock_guard<mutex_type> lock(mutex_);
+        if(state->prev_) {
+            state->prev_->next_ = state->next_;
+        } else {
+            descriptors_ = state->next_;
+        }
+        if(state->next_) {
+            state->next_->prev_ = state->prev_;
+        }
+        abort_ops(*state, aborted);
+    }
+    // Completing the aborted operations waits for their cancellation
+    // callbacks, which may still refer to the state, to return.
+    complete_ops(aborted);
+    delete state;
+}
+
+inline void select_reactor::start_op(op_type type,
+        per_descriptor_data& data, reactor_op* op)
+{
+    std::unique_lock<mutex_type> lock(mutex_);
+    if(op->cancelled_) {
+        lock.unlock();
+        op->ec_ = std::make_error_code(std::errc::operation_canceled);
+        op->complete();
+        return;
+    }
+    op_queue<reactor_op>& ops = data->op_queues_[type];
+    // Operations queued before this one go first. Otherwise the operation is
+    // attempted before waiting for select, which would most likely report the
+    // descriptor ready anyway.
+    const bool is_first = ops.empty();
+    if(is_first && op->perform()) {
+        lock.unlock();
+        op->complete();
+        return;
+    }
+    ops.push(op);
+    if(is_first) {
+        add_interest(data->descriptor_, type);
+    }
+    scheduler_.work_started();
+    lock.unlock();
+
+    // A thread blocked in select doesn't wait for this kind of readiness of
+    // the descriptor yet. The thread running a single-threaded scheduler is
+    // not blocked, and selects the descriptor on its next run.
+    if(is_first && (scheduler_.is_concurrent() || !scheduler_.running_in_this_thread())) {
+        interrupter_.interrupt();
+    }
+}
+
+inline void select_reactor::cancel_ops(per_descriptor_data& data)
+{
+    op_queue<reactor_op> aborted;
+    {
+        std::lock_guard<mutex_type> lock(mutex_);
+        abort_ops(*data, aborted);
+    }
+    complete_ops(aborted);
+}
+
+inline bool select_reactor::cancel_op(op_type type,
+        per_descriptor_data& data, reactor_op* op)
+{
+    std::lock_guard<mutex_type> lock(mutex_);
+    op->cancelled_ = true;
+    op_queue<reactor_op>& ops = data->op_queues_[type];
+    if(!ops.remove(op)) {
+        return false;
+    }
+    if(ops.empty()) {
+        remove_interest(data->descriptor_, type);
+    }
+    op->ec_ = std::make_error_code(std::errc::operation_canceled);
+    return true;
+}
+
+inline void select_reactor::abort_all_ops()
+{
+    op_queue<reactor_op> aborted;
+    {
+        std::lock_guard<mutex_type> lock(mutex_);
+        for(descriptor_data* data = descriptors_; data; data = data->next_) {
+            abort_ops(*data, aborted);
+        }
+    }
+    complete_ops(aborted);
+}
+
+inline bool select_reactor::has_pending_ops()
+{
+    std::lock_guard<mutex_type> lock(mutex_);
+    for(descriptor_data* data = descriptors_; data; data = data->next_) {
+        for(auto& ops : data->op_queues_) {
+            if(!ops.empty()) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+inline void select_reactor::run(duration timeout)
+{
+    int max_fd;
+    {
+        std::lock_guard<mutex_type> lock(mutex_);
+        std::memcpy(fd_sets_, master_sets_, sizeof(fd_sets_));
+        max_fd = max_descriptor_;
+    }
+
+    timeval tv;
+    timeval* tvp = nullptr;
+    if(timeout != duration::max()) {
+        // Round up, so that we don't wake up just before a timer is due
+        // only to go back to sleep for a few microseconds.
+        auto us = duration_cast<microseconds>(timeout);
+        if(us < timeout) {
+            ++us;
+        }
+        tv.tv_sec = us.count() / 1000000;
+        tv.tv_usec = us.count() % 1000000;
+        tvp = &tv;
+    }
+    const int result = ::select(max_fd + 1, &fd_sets_[reactor_op::read_op],
+            &fd_sets_[reactor_op::write_op], &fd_sets_[reactor_op::except_op], tvp);
+    if(result <= 0) {
+        // Timed out, interrupted by a signal, or a descriptor was closed after
+        // the sets were filled in, which the next run leaves out.
+        return;
+    }
+
+    // The number of ready descriptors that are yet to be found in the sets.
+    int num_ready = result;
+    if(FD_ISSET(interrupter_.read_descriptor(), &fd_sets_[reactor_op::read_op])) {
+        interrupter_.reset();
+        --num_ready;
+    }
+#if FREETURES_HAS_TIMERFD
+    if(FD_ISSET(timer_.descriptor(), &fd_sets_[reactor_op::read_op])) {
+        // The scheduler collects the due timers once run returns.
+        timer_.reset();
+        --num_ready;
+    }
+#endif
+
+    op_queue<reactor_op> completed;
+    {
+        std::lock_guard<mutex_type> lock(mutex_);
+        for(descriptor_data* state = descriptors_; state && num_ready > 0;
+                state = state->next_) {
+            // Out-of-band data first, as it may be urgent.
+            for(int type = reactor_op::max_ops - 1; type >= 0; --type) {
+                if(!FD_ISSET(state->descriptor_, &fd_sets_[type])) {
+                    continue;
+                }
+                --num_ready;
+                // The descriptor may have been registered anew under the same
+                // number since select returned, in which case its operations
+                // merely report that they would block.
+                if(!state->op_queues_[type].empty()) {
+                    perform_ops(*state, type, completed);
+                    if(state->op_queues_[type].empty()) {
+                        remove_interest(state->descriptor_, type);
+                    }
+                }
+            }
+        }
+    }
+    complete_ops(completed);
+}
+
+inline void select_reactor::perform_ops(descriptor_data& data,
+        int type, op_queue<reactor_op>& completed)
+{
+    if(type == reactor_op::write_op) {
+        perform_writes(data, completed);
+        return;
+    }
+    op_queue<reactor_op>& ops = data.op_queues_[type];
+    while(reactor_op* op = ops.front()) {
+        if(!op->perform()) {
+            return;
+        }
+        completed.push(ops.pop());
+    }
+}
+
+inline void select_reactor::perform_writes(descriptor_data& data,
+        op_queue<reactor_op>& completed)
+{
+    op_queue<reactor_op>& ops = data.op_queues_[reactor_op::write_op];
+    while(reactor_op* op = ops.front()) {
+        // Writes of a single buffer at the front of the queue go out in one
+        // system call; anything else is performed on its own.
+        reactor_op* gathered[max_gathered_writes];
+        iovec buffers[max_gathered_writes];
+        int n = 0;
+        while(n < max_gathered_writes && ops.front() && ops.front()->buffer_) {
+            gathered[n] = ops.pop();
+            buffers[n].iov_base = gathered[n]->buffer_;
+            buffers[n].iov_len = gathered[n]->buffer_size_;
+            ++n;
+        }
+        if(n <= 1) {
+            if(n == 1) {
+                ops.push_front(op);
+            }
+            if(!op->perform()) {
+                return;
+            }
+            completed.push(ops.pop());
+            continue;
+        }
+
+        ssize_t result;
+        do {
+            result = ::writev(data.descriptor_, buffers, n);
+        } while(result < 0 && errno == EINTR);
+        const int error = result < 0 ? errno : 0;
+        if(error) {
+            for(int i = n - 1; i >= 0; --i) {
+                ops.push_front(gathered[i]);
+            }
+            if(error == EAGAIN || error == EWOULDBLOCK) {
+                return;
+            }
+            // The first write fails, and the ones after it find out about the
+            // error on their own.
+            op = ops.pop();
+            op->ec_ = std::error_code(error, std::system_category());
+            completed.push(op);
+            continue;
+        }
+
+        // The bytes written are handed out in order: writes that went out in
+        // full are done, and so is the first that went out in part (or not
+        // at all, if it's empty), as a write may be short.
+        std::size_t remaining = static_cast<std::size_t>(result);
+        int i = 0;
+        while(i < n) {
+            const std::size_t size = gathered[i]->buffer_size_;
+            if(remaining == 0 && size > 0) {
+                break;
+            }
+            const std::size_t written = size < remaining ? size : remaining;
+            gathered[i]->bytes_transferred_ = written;
+            completed.push(gathered[i++]);
+            remaining -= written;
+            if(written < size) {
+                break;
+            }
+        }
+        if(i < n) {
+            // A short write: the descriptor is full, so the rest waits for
+            // the next select call.
+            for(int j = n - 1; j >= i; --j) {
+                ops.push_front(gathered[j]);
+            }
+            return;
+        }
+    }
+}
+
+inline void select_reactor::add_interest(int descriptor, int type) noexcept
+{
+    FD_SET(descriptor, &master_sets_[type]);
+    if(descriptor > max_descriptor_) {
+        max_descriptor_ = descriptor;
+    }
+}
+
+inline void select_reactor::remove_interest(int descriptor, int type) noexcept
+{
+    FD_CLR(descriptor, &master_sets_[type]);
+    // Only when the highest descriptor leaves the sets does the next highest
+    // need to be found. The interrupter (and timer) never leave them.
+    while(!FD_ISSET(max_descriptor_, &master_sets_[reactor_op::read_op])
+            && !FD_ISSET(max_descriptor_, &master_sets_[reactor_op::write_op])
+            && !FD_ISSET(max_descriptor_, &master_sets_[reactor_op::except_op])) {
+        --max_descriptor_;
+    }
+}
+
+inline void select_reactor::abort_ops(descriptor_data& data,
+        op_queue<reactor_op>& aborted) noexcept
+{
+    for(int type = 0; type < reactor_op::max_ops; ++type) {
+        op_queue<reactor_op>& ops = data.op_queues_[type];
+        if(ops.empty()) {
+            continue;
+        }
+        while(reactor_op* op = ops.pop()) {
+            op->ec_ = std::make_error_code(std::errc::operation_canceled);
+            aborted.push(op);
+        }
+        remove_interest(data.descriptor_, type);
+    }
+}
+
+inline void select_reactor::complete_ops(op_queue<reactor_op>& ops)
+{
+    while(reactor_op* op = ops.pop()) {
+        op->complete();
+        scheduler_.work_finished();
+    }
+}
+
+} // detail
+} // ft
+
+#endif
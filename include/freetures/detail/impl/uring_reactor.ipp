@@ -0,0 +1,771 @@
+#ifndef FREETURES_URING_REACTOR_IPP
+#define FREETURES_URING_REACTOR_IPP
+
+#include "../config.hpp"
+
+#if FREETURES_HAS_IO_URING
+
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <system_error>
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "../scheduler.hpp"
+#include "../uring_reactor.hpp"
+
+namespace ft {
+namespace detail {
+
+namespace uring {
+
+// The rings are shared with the kernel, which reads what we publish with
+// acquire semantics and publishes with release semantics.
+inline unsigned load_acquire(const unsigned* p) noexcept
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+inline void store_release(unsigned* p, unsigned v) noexcept
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+inline std::uint32_t poll_mask(int type) noexcept
+{
+    std::uint32_t mask = type == reactor_op::read_op ? POLLIN
+        : type == reactor_op::write_op ? POLLOUT : POLLPRI;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    // The kernel expects the halves of the mask swapped.
+    mask = (mask << 16) | (mask >> 16);
+#endif
+    return mask;
+}
+
+inline std::error_code to_error_code(int res) noexcept
+{
+    return res == -ECANCELED ? std::make_error_code(std::errc::operation_canceled)
+        : std::error_code(-res, std::system_category());
+}
+
+} // uring
+
+inline uring_reactor::uring_reactor(scheduler& s)
+    : scheduler_(s)
+{
+    if(!init_ring()) {
+        close_ring();
+        readiness_.reset(new epoll_reactor(s));
+    }
+}
+
+inline uring_reactor::~uring_reactor()
+{
+    // Closing the ring cancels what's still in it. Operations whose
+    // completions were not reaped are lost, like those queued in any reactor
+    // that's destroyed before its descriptors are deregistered.
+    close_ring();
+}
+
+inline bool uring_reactor::init_ring()
+{
+    io_uring_params params = {};
+    ring_descriptor_ = static_cast<int>(
+            ::syscall(__NR_io_uring_setup, num_entries, &params));
+    if(ring_descriptor_ < 0) {
+        ring_descriptor_ = -1;
+        return false;
+    }
+    const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP
+        | IORING_FEAT_FAST_POLL | IORING_FEAT_EXT_ARG;
+    if((params.features & required) != required) {
+        return false;
+    }
+
+    // The submission and completion queues share a single mapping.
+    const std::size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    const std::size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    ring_size_ = sq_size > cq_size ? sq_size : cq_size;
+    void* ring = ::mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring_descriptor_, IORING_OFF_SQ_RING);
+    if(ring == MAP_FAILED) {
+        return false;
+    }
+    ring_ = ring;
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring_descriptor_, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        return false;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    char* base = static_cast<char*>(ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    sq_entries_ = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_entries);
+    cq_head_ = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+    // Entries are always taken in order, so the indirection array is fixed.
+    auto* array = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+    for(unsigned i = 0; i < sq_entries_; ++i) {
+        array[i] = i;
+    }
+
+    // Empty tables of fixed files and buffers, filled in as descriptors and
+    // buffers are registered.
+    io_uring_rsrc_register tables = {};
+    tables.flags = IORING_RSRC_REGISTER_SPARSE;
+    tables.nr = max_fixed_files;
+    if(::syscall(__NR_io_uring_register, ring_descriptor_,
+            IORING_REGISTER_FILES2, &tables, sizeof(tables)) < 0) {
+        return false;
+    }
+    tables.nr = max_registered_buffers;
+    if(::syscall(__NR_io_uring_register, ring_descriptor_,
+            IORING_REGISTER_BUFFERS2, &tables, sizeof(tables)) < 0) {
+        return false;
+    }
+    free_fixed_files_.reserve(max_fixed_files);
+    for(int i = max_fixed_files - 1; i >= 0; --i) {
+        free_fixed_files_.push_back(i);
+    }
+
+    // Cancelling by descriptor is how operations are withdrawn, and kernels
+    // that don't support it reject the flags.
+    io_uring_sqe* sqe = next_sqe();
+    prepare_cancel(*sqe, interrupter_.read_descriptor());
+    commit_sqe();
+    num_unsubmitted_ = 0;
+    if(enter(1, 1, IORING_ENTER_GETEVENTS) != 1) {
+        return false;
+    }
+    const unsigned head = *cq_head_;
+    if(head == uring::load_acquire(cq_tail_)) {
+        return false;
+    }
+    const int res = cqes_[head & cq_mask_].res;
+    uring::store_release(cq_head_, head + 1);
+    return res != -EINVAL;
+}
+
+inline void uring_reactor::close_ring() noexcept
+{
+    if(sqes_) {
+        ::munmap(sqes_, sqes_size_);
+        sqes_ = nullptr;
+    }
+    if(ring_) {
+        ::munmap(ring_, ring_size_);
+        ring_ = nullptr;
+    }
+    if(ring_descriptor_ != -1) {
+        ::close(ring_descriptor_);
+        ring_descriptor_ = -1;
+    }
+}
+
+inline std::error_code uring_reactor::register_descriptor(
+        int descriptor, per_descriptor_data& data)
+{
+    auto* state = new descriptor_state(descriptor);
+    if(readiness_) {
+        const std::error_code error = readiness_->register_descriptor(
+                descriptor, state->readiness_data_);
+        if(error) {
+            delete state;
+            return error;
+        }
+    } else {
+        std::lock_guard<mutex_type> lock(mutex_);
+        link_state(*state);
+        // If the table is full, the descriptor is merely looked up by the
+        // kernel on each operation.
+        if(!free_fixed_files_.empty()) {
+            const int index = free_fixed_files_.back();
+            if(!update_resource(IORING_REGISTER_FILES_UPDATE2, index, &descriptor)) {
+                free_fixed_files_.pop_back();
+                state->fixed_index_ = index;
+            }
+        }
+    }
+    data = state;
+    return {};
+}
+
+inline void uring_reactor::deregister_descriptor(per_descriptor_data& data)
+{
+    descriptor_state* state = data;
+    if(state == nullptr) {
+        return;
+    }
+    data = nullptr;
+    if(readiness_) {
+        readiness_->deregister_descriptor(state->readiness_data_);
+        delete state;
+        return;
+    }
+
+    op_queue<reactor_op> aborted;
+    bool in_ring;
+    {
+        std::lock_guard<mutex_type> lock(mutex_);
+        state->shutdown_ = true;
+        // The cancellation has to reach the kernel while the descriptor is
+        // still open, and before it leaves the table of fixed files.
+        in_ring = abort_ops(*state, aborted);
+        if(!in_ring) {
+            unlink_state(*state);
+        }
+        if(state->fixed_index_ != -1) {
+            const int none = -1;
+            update_resource(IORING_REGISTER_FILES_UPDATE2, state->fixed_index_, &none);
+            free_fixed_files_.push_back(state->fixed_index_);
+        }
+    }
+    // Completing the aborted operations waits for their cancellation
+    // callbacks, which may still refer to the state, to return.
+    complete_ops(aborted);
+    if(!in_ring) {
+        delete state;
+    }
+}
+
+inline std::error_code uring_reactor::register_buffer(void* data, std::size_t size)
+{
+    if(readiness_) {
+        return readiness_->register_buffer(data, size);
+    }
+    std::lock_guard<mutex_type> lock(mutex_);
+    if(num_buffers_ == max_registered_buffers) {
+        return std::make_error_code(std::errc::no_buffer_space);
+    }
+    iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = size;
+    const std::error_code error = update_resource(
+            IORING_REGISTER_BUFFERS_UPDATE, num_buffers_, &iov);
+    if(!error) {
+        buffers_[num_buffers_++] = registered_buffer{static_cast<char*>(data), size};
+    }
+    return error;
+}
+
+inline void uring_reactor::start_op(op_type type,
+        per_descriptor_data& data, reactor_op* op)
+{
+    if(readiness_) {
+        readiness_->start_op(type, data->readiness_data_, op);
+        return;
+    }
+    scheduler_.work_started();
+    std::unique_lock<mutex_type> lock(mutex_);
+    if(op->cancelled_) {
+        lock.unlock();
+        op->ec_ = std::make_error_code(std::errc::operation_canceled);
+        op->complete();
+        scheduler_.work_finished();
+        return;
+    }
+    op_queue<reactor_op>& ops = data->op_queues_[type];
+    const bool is_first = ops.empty();
+    ops.push(op);
+    if(!is_first) {
+        // Submitted once the ones before it complete.
+        return;
+    }
+    submit_op(*data, type);
+    // The thread running a single-threaded scheduler is the one that waits
+    // for completions next, which submits the operation along with any
+    // others started in the meantime. Anyone else has to submit it now.
+    if(scheduler_.is_concurrent() || !scheduler_.running_in_this_thread()) {
+        submit();
+    }
+}
+
+inline void uring_reactor::cancel_ops(per_descriptor_data& data)
+{
+    if(readiness_) {
+        readiness_->cancel_ops(data->readiness_data_);
+        return;
+    }
+    op_queue<reactor_op> aborted;
+    {
+        std::lock_guard<mutex_type> lock(mutex_);
+        abort_ops(*data, aborted);
+    }
+    complete_ops(aborted);
+}
+
+inline bool uring_reactor::cancel_op(op_type type,
+        per_descriptor_data& data, reactor_op* op)
+{
+    if(readiness_) {
+        return readiness_->cancel_op(type, data->readiness_data_, op);
+    }
+    std::lock_guard<mutex_type> lock(mutex_);
+    op->cancelled_ = true;
+    op_queue<reactor_op>& ops = data->op_queues_[type];
+    if(ops.front() == op) {
+        // It's in the ring, as a transfer or as a poll.
+        const auto state = reinterpret_cast<std::uint64_t>(data);
+        prepare_cancel_one(*next_sqe(), state | (transfer_tag + type));
+        commit_sqe();
+        prepare_cancel_one(*next_sqe(), state | (poll_tag + type));
+        commit_sqe();
+        if(scheduler_.is_concurrent() || !scheduler_.running_in_this_thread()) {
+            submit();
+        }
+        return false;
+    }
+    if(!ops.remove(op)) {
+        return false;
+    }
+    op->ec_ = std::make_error_code(std::errc::operation_canceled);
+    return true;
+}
+
+inline void uring_reactor::abort_all_ops()
+{
+    if(readiness_) {
+        readiness_->abort_all_ops();
+        return;
+    }
+    op_queue<reactor_op> aborted;
+    {
+        std::lock_guard<mutex_type> lock(mutex_);
+        bool cancelled = false;
+        for(descriptor_state* state = states_; state; state = state->next_) {
+            if(state->shutdown_) {
+                // Its operations are already being cancelled.
+                continue;
+            }
+            for(int type = 0; type < reactor_op::max_ops; ++type) {
+                op_queue<reactor_op>& ops = state->op_queues_[type];
+                reactor_op* first = ops.pop();
+                if(first == nullptr) {
+                    continue;
+                }
+                while(reactor_op* op = ops.pop()) {
+                    op->ec_ = std::make_error_code(std::errc::operation_canceled);
+                    aborted.push(op);
+                }
+                ops.push(first);
+                if(!first->cancelled_) {
+                    first->cancelled_ = true;
+                    const auto data = reinterpret_cast<std::uint64_t>(state);
+                    prepare_cancel_one(*next_sqe(), data | (transfer_tag + type));
+                    commit_sqe();
+                    prepare_cancel_one(*next_sqe(), data | (poll_tag + type));
+                    commit_sqe();
+                    cancelled = true;
+                }
+            }
+        }
+        if(cancelled) {
+            submit();
+        }
+    }
+    complete_ops(aborted);
+}
+
+inline bool uring_reactor::has_pending_ops()
+{
+    if(readiness_) {
+        return readiness_->has_pending_ops();
+    }
+    std::lock_guard<mutex_type> lock(mutex_);
+    for(descriptor_state* state = states_; state; state = state->next_) {
+        for(auto& ops : state->op_queues_) {
+            if(!ops.empty()) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+inline void uring_reactor::interrupt()
+{
+    if(readiness_) {
+        readiness_->interrupt();
+    } else {
+        interrupter_.interrupt();
+    }
+}
+
+inline void uring_reactor::run(duration timeout)
+{
+    if(readiness_) {
+        readiness_->run(timeout);
+        return;
+    }
+
+    unsigned to_submit;
+    bool backlogged;
+    {
+        std::lock_guard<mutex_type> lock(mutex_);
+        flush_backlog();
+        if(!interrupter_polled_) {
+            io_uring_sqe* sqe = next_sqe();
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = interrupter_.read_descriptor();
+            sqe->poll32_events = uring::poll_mask(reactor_op::read_op);
+            sqe->user_data = interrupter_data;
+            commit_sqe();
+            interrupter_polled_ = true;
+        }
+        to_submit = num_unsubmitted_;
+        num_unsubmitted_ = 0;
+        backlogged = !backlog_.empty();
+    }
+
+    // Submit and wait in one call, unless there's nothing to wait for, or
+    // entries are still waiting for room in the submission queue, which only
+    // reaping completions makes.
+    unsigned flags = 0;
+    unsigned min_complete = 0;
+    io_uring_getevents_arg arg = {};
+    __kernel_timespec ts = {};
+    if(timeout != duration::zero() && !backlogged
+            && *cq_head_ == uring::load_acquire(cq_tail_)) {
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        min_complete = 1;
+        arg.sigmask_sz = _NSIG / 8;
+        if(timeout != duration::max()) {
+            const auto s = duration_cast<seconds>(timeout);
+            ts.tv_sec = s.count();
+            ts.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    timeout - s).count();
+            arg.ts = reinterpret_cast<std::uint64_t>(&ts);
+        }
+    }
+    const int result = flags ? enter(to_submit, min_complete, flags, &arg, sizeof(arg))
+        : to_submit ? enter(to_submit, 0, 0) : 0;
+    // A wait that times out or is interrupted still reports what it submitted.
+    const unsigned submitted = result > 0 ? unsigned(result) : 0;
+    if(submitted < to_submit) {
+        std::lock_guard<mutex_type> lock(mutex_);
+        num_unsubmitted_ += to_submit - submitted;
+    }
+
+    op_queue<reactor_op> completed;
+    descriptor_state* dead = nullptr;
+    {
+        std::lock_guard<mutex_type> lock(mutex_);
+        unsigned head = *cq_head_;
+        const unsigned tail = uring::load_acquire(cq_tail_);
+        for(; head != tail; ++head) {
+            handle_cqe(cqes_[head & cq_mask_], completed, dead);
+        }
+        uring::store_release(cq_head_, head);
+    }
+    // Completing the operations waits for their cancellation callbacks, which
+    // may still refer to the states, to return.
+    complete_ops(completed);
+    while(dead) {
+        descriptor_state* next = dead->next_free_;
+        delete dead;
+        dead = next;
+    }
+}
+
+inline io_uring_sqe* uring_reactor::next_sqe()
+{
+    io_uring_sqe* sqe = nullptr;
+    // Entries go in order, so nothing overtakes the backlog.
+    if(backlog_.empty()) {
+        const unsigned tail = *sq_tail_;
+        if(tail - uring::load_acquire(sq_head_) == sq_entries_) {
+            // The kernel copies entries as they're submitted, so this frees
+            // those it accepts.
+            submit();
+        }
+        if(tail - uring::load_acquire(sq_head_) != sq_entries_) {
+            sqe = &sqes_[tail & sq_mask_];
+        }
+    }
+    if(sqe == nullptr) {
+        backlog_.emplace_back();
+        sqe = &backlog_.back();
+        // A thread waiting for completions moves it into the queue once it
+        // reaps them.
+        interrupter_.interrupt();
+    }
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+inline void uring_reactor::commit_sqe() noexcept
+{
+    // An entry in the backlog is committed by flush_backlog.
+    if(!backlog_.empty()) {
+        return;
+    }
+    uring::store_release(sq_tail_, *sq_tail_ + 1);
+    ++num_unsubmitted_;
+}
+
+inline void uring_reactor::flush_backlog() noexcept
+{
+    std::size_t n = 0;
+    unsigned tail = *sq_tail_;
+    while(n < backlog_.size()
+            && tail - uring::load_acquire(sq_head_) != sq_entries_) {
+        sqes_[tail & sq_mask_] = backlog_[n++];
+        ++tail;
+    }
+    if(n == 0) {
+        return;
+    }
+    uring::store_release(sq_tail_, tail);
+    num_unsubmitted_ += unsigned(n);
+    backlog_.erase(backlog_.begin(), backlog_.begin() + std::ptrdiff_t(n));
+}
+
+inline void uring_reactor::submit()
+{
+    while(num_unsubmitted_ > 0) {
+        const int result = enter(num_unsubmitted_, 0, 0);
+        if(result > 0) {
+            num_unsubmitted_ -= unsigned(result);
+        } else if(result != -EINTR) {
+            // E.g. EBUSY, while the completion queue overflows: the entries
+            // are submitted by the next wait, once completions are reaped.
+            break;
+        }
+    }
+}
+
+inline void uring_reactor::submit_op(descriptor_state& state, op_type type)
+{
+    reactor_op* op = state.op_queues_[type].front();
+    io_uring_sqe* sqe = next_sqe();
+    if(op->buffer_ && type != reactor_op::except_op) {
+        prepare_transfer(*sqe, type, state, op);
+    } else {
+        prepare_poll(*sqe, type, state);
+    }
+    commit_sqe();
+}
+
+inline void uring_reactor::prepare_transfer(io_uring_sqe& sqe, op_type type,
+        descriptor_state& state, reactor_op* op) const noexcept
+{
+    const bool is_read = type == reactor_op::read_op;
+    sqe.opcode = is_read ? IORING_OP_READ : IORING_OP_WRITE;
+    const char* data = static_cast<const char*>(op->buffer_);
+    for(unsigned i = 0; i < num_buffers_; ++i) {
+        const registered_buffer& b = buffers_[i];
+        if(data >= b.data && data + op->buffer_size_ <= b.data + b.size) {
+            sqe.opcode = is_read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+            sqe.buf_index = static_cast<std::uint16_t>(i);
+            break;
+        }
+    }
+    if(state.fixed_index_ != -1) {
+        sqe.fd = state.fixed_index_;
+        sqe.flags = IOSQE_FIXED_FILE;
+    } else {
+        sqe.fd = state.descriptor_;
+    }
+    // Streams have no offset: read and write at the current position.
+    sqe.off = ~std::uint64_t(0);
+    sqe.addr = reinterpret_cast<std::uint64_t>(data);
+    sqe.len = op->buffer_size_ > 0xffffffffu ? 0xffffffffu
+        : static_cast<std::uint32_t>(op->buffer_size_);
+    sqe.user_data = reinterpret_cast<std::uint64_t>(&state) | (transfer_tag + type);
+}
+
+inline void uring_reactor::prepare_poll(io_uring_sqe& sqe,
+        op_type type, descriptor_state& state) noexcept
+{
+    sqe.opcode = IORING_OP_POLL_ADD;
+    if(state.fixed_index_ != -1) {
+        sqe.fd = state.fixed_index_;
+        sqe.flags = IOSQE_FIXED_FILE;
+    } else {
+        sqe.fd = state.descriptor_;
+    }
+    sqe.poll32_events = uring::poll_mask(type);
+    sqe.user_data = reinterpret_cast<std::uint64_t>(&state) | (poll_tag + type);
+}
+
+inline void uring_reactor::prepare_cancel(io_uring_sqe& sqe, int descriptor) noexcept
+{
+    // This finds the operations on the descriptor's file however they refer
+    // to it, by fixed index or not.
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.fd = descriptor;
+    sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe.user_data = ignored_data;
+}
+
+inline void uring_reactor::prepare_cancel_one(io_uring_sqe& sqe,
+        std::uint64_t user_data) noexcept
+{
+    // Finds the operation submitted with user_data, if it's still in the ring.
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.fd = -1;
+    sqe.addr = user_data;
+    sqe.user_data = ignored_data;
+}
+
+inline bool uring_reactor::abort_ops(descriptor_state& state,
+        op_queue<reactor_op>& aborted)
+{
+    bool in_ring = false;
+    for(auto& ops : state.op_queues_) {
+        reactor_op* first = ops.pop();
+        if(first == nullptr) {
+            continue;
+        }
+        while(reactor_op* op = ops.pop()) {
+            op->ec_ = std::make_error_code(std::errc::operation_canceled);
+            aborted.push(op);
+        }
+        // The first one completes through the ring.
+        ops.push(first);
+        in_ring = true;
+    }
+    if(in_ring) {
+        prepare_cancel(*next_sqe(), state.descriptor_);
+        commit_sqe();
+        submit();
+    }
+    return in_ring;
+}
+
+inline void uring_reactor::handle_cqe(const io_uring_cqe& cqe,
+        op_queue<reactor_op>& completed, descriptor_state*& dead)
+{
+    if(cqe.user_data == ignored_data) {
+        return;
+    }
+    if(cqe.user_data == interrupter_data) {
+        interrupter_.reset();
+        // Renewed by the next run.
+        interrupter_polled_ = false;
+        return;
+    }
+
+    auto* state = reinterpret_cast<descriptor_state*>(cqe.user_data & ~tag_mask);
+    const std::uint64_t tag = cqe.user_data & tag_mask;
+    const bool is_poll = tag >= poll_tag;
+    const auto type = static_cast<op_type>(is_poll ? tag - poll_tag : tag - transfer_tag);
+    op_queue<reactor_op>& ops = state->op_queues_[type];
+    reactor_op* op = ops.front();
+
+    if(cqe.res < 0 && cqe.res != -EAGAIN) {
+        op->ec_ = uring::to_error_code(cqe.res);
+    } else if(state->shutdown_) {
+        // Ready, but no longer wanted.
+        if(is_poll || cqe.res < 0) {
+            op->ec_ = std::make_error_code(std::errc::operation_canceled);
+        } else {
+            op->bytes_transferred_ = static_cast<std::size_t>(cqe.res);
+        }
+    } else if(op->cancelled_ && (is_poll || cqe.res == -EAGAIN)) {
+        // Ready (or not), but the cancellation came too late to reach the
+        // kernel, and nothing has been transferred yet.
+        op->ec_ = std::make_error_code(std::errc::operation_canceled);
+    } else if(is_poll) {
+        if(!op->perform()) {
+            // Someone else got there first: wait for the next readiness.
+            prepare_poll(*next_sqe(), type, *state);
+            commit_sqe();
+            return;
+        }
+    } else if(cqe.res == -EAGAIN) {
+        // Older kernels honour O_NONBLOCK rather than wait for readiness
+        // themselves: wait for it with a poll, then perform the transfer.
+        prepare_poll(*next_sqe(), type, *state);
+        commit_sqe();
+        return;
+    } else {
+        op->bytes_transferred_ = static_cast<std::size_t>(cqe.res);
+    }
+
+    completed.push(ops.pop());
+    if(!ops.empty()) {
+        submit_op(*state, type);
+    } else if(state->shutdown_) {
+        for(auto& other : state->op_queues_) {
+            if(!other.empty()) {
+                return;
+            }
+        }
+        unlink_state(*state);
+        state->next_free_ = dead;
+        dead = state;
+    }
+}
+
+inline void uring_reactor::link_state(descriptor_state& state) noexcept
+{
+    state.next_ = states_;
+    if(states_) {
+        states_->prev_ = &state;
+    }
+    states_ = &state;
+}
+
+inline void uring_reactor::unlink_state(descriptor_state& state) noexcept
+{
+    if(state.prev_) {
+        state.prev_->next_ = state.next_;
+    } else {
+        states_ = state.next_;
+    }
+    if(state.next_) {
+        state.next_->prev_ = state.prev_;
+    }
+}
+
+inline void uring_reactor::complete_ops(op_queue<reactor_op>& ops)
+{
+    while(reactor_op* op = ops.pop()) {
+        op->complete();
+        scheduler_.work_finished();
+    }
+}
+
+inline int uring_reactor::enter(unsigned to_submit, unsigned min_complete,
+        unsigned flags, const void* arg, std::size_t arg_size) noexcept
+{
+    const long result = ::syscall(__NR_io_uring_enter, ring_descriptor_,
+            to_submit, min_complete, flags, arg, arg_size);
+    return result < 0 ? -errno : static_cast<int>(result);
+}
+
+inline std::error_code uring_reactor::update_resource(
+        unsigned opcode, unsigned index, const void* data) noexcept
+{
+    io_uring_rsrc_update2 update = {};
+    update.offset = index;
+    update.data = reinterpret_cast<std::uint64_t>(data);
+    update.nr = 1;
+    if(::syscall(__NR_io_uring_register, ring_descriptor_, opcode,
+            &update, sizeof(update)) < 0) {
+        return std::error_code(errno, std::system_category());
+    }
+    return {};
+}
+
+} // detail
+} // ft
+
+#endif // FREETURES_HAS_IO_URING
+
+#endif
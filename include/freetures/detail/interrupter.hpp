@@ -0,0 +1,25 @@
+#ifndef FREETURES_INTERRUPTER_HPP
+#define FREETURES_INTERRUPTER_HPP
+
+#include "config.hpp"
+
+#if FREETURES_HAS_EVENTFD
+# include "eventfd_interrupter.hpp"
+#else
+# include "select_interrupter.hpp"
+#endif
+
+namespace ft {
+namespace detail {
+
+/** What wakes up a blocked reactor (see FREETURES_HAS_EVENTFD). */
+#if FREETURES_HAS_EVENTFD
+using interrupter = eventfd_interrupter;
+#else
+using interrupter = select_interrupter;
+#endif
+
+} // detail
+} // ft
+
+#endif
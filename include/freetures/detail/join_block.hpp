@@ -0,0 +1,114 @@
+#ifndef FREETURES_JOIN_BLOCK_HPP
+#define FREETURES_JOIN_BLOCK_HPP
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+#include "ref_count.hpp"
+#include "scheduler.hpp"
+
+namespace ft {
+namespace detail {
+
+/**
+ * The base of the blocks in which the combinators of futures (see when_all.hpp
+ * and when_any.hpp) keep their inputs' results and their progress.
+ *
+ * A block is a single allocation from the scheduler's pool, which may be
+ * followed by an array of a number of elements only known at runtime (see
+ * @ref trailing). It counts its own references, which are held by the
+ * continuations it attaches to its inputs, so it lives until the last of them
+ * has been invoked or dropped.
+ */
+template<typename Derived>
+class join_block
+{
+    ref_count refs_;
+    scheduler& scheduler_;
+    // The number of bytes the block was allocated with.
+    std::size_t size_ = 0;
+
+protected:
+    explicit join_block(scheduler& s) noexcept : scheduler_(s) {}
+    ~join_block() = default;
+
+    /** The offset of an array of `T`s following the block. */
+    template<typename T>
+    static constexpr std::size_t trailing_offset() noexcept
+    {
+        return (sizeof(Derived) + alignof(T) - 1) / alignof(T) * alignof(T);
+    }
+
+    /** The array of `T`s following the block. */
+    template<typename T>
+    T* trailing() noexcept
+    {
+        return reinterpret_cast<T*>(reinterpret_cast<char*>(this)
+                + trailing_offset<T>());
+    }
+
+public:
+    join_block(const join_block&) = delete;
+    join_block& operator=(const join_block&) = delete;
+
+    /**
+     * Allocates a block followed by an array of @p n `T`s from the pool of @p
+     * s. The block is responsible for constructing and destroying the array.
+     *
+     * @return The block, with a single reference owned by the caller.
+     */
+    template<typename T, typename... Args>
+    static intrusive_ptr<Derived> create_with_trailing(
+            std::size_t n, scheduler& s, Args&&... args)
+    {
+        static_assert(alignof(T) <= alignof(std::max_align_t),
+                "over-aligned trailing elements are not supported");
+        return create_sized(trailing_offset<T>() + n * sizeof(T),
+                s, std::forward<Args>(args)...);
+    }
+
+    /** Like @ref create_with_trailing, for blocks without an array. */
+    template<typename... Args>
+    static intrusive_ptr<Derived> create(scheduler& s, Args&&... args)
+    {
+        return create_sized(sizeof(Derived), s, std::forward<Args>(args)...);
+    }
+
+    void add_ref() noexcept
+    {
+        refs_.increment();
+    }
+
+    void release() noexcept
+    {
+        if(refs_.decrement()) {
+            scheduler& s = scheduler_;
+            const std::size_t size = size_;
+            Derived* self = static_cast<Derived*>(this);
+            self->~Derived();
+            s.get_allocator().deallocate(self, size);
+        }
+    }
+
+    scheduler& get_scheduler() noexcept
+    {
+        return scheduler_;
+    }
+
+private:
+    template<typename... Args>
+    static intrusive_ptr<Derived> create_sized(
+            std::size_t size, scheduler& s, Args&&... args)
+    {
+        void* p = s.get_allocator().allocate(size);
+        Derived* block = ::new(p) Derived(s, std::forward<Args>(args)...);
+        block->size_ = size;
+        return intrusive_ptr<Derived>(block);
+    }
+};
+
+} // detail
+} // ft
+
+#endif
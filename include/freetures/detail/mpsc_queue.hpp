@@ -0,0 +1,97 @@
+#ifndef FREETURES_MPSC_QUEUE_HPP
+#define FREETURES_MPSC_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+
+#include "op_queue.hpp"
+
+namespace ft {
+namespace detail {
+
+/** Assumed size of a cache line, used to keep contended atomics apart. */
+constexpr std::size_t cache_line_size = 64;
+
+/**
+ * An intrusive, lock-free multi-producer queue of operations.
+ *
+ * Producers push onto a single atomic list head with a CAS, which is all the
+ * synchronization a post from another thread costs. The consumer takes the
+ * entire list at once with a single exchange and restores FIFO order on its
+ * own side, so it never contends with producers element by element. Since a
+ * batch is taken atomically, several consumers are safe as well, though each
+ * batch ends up with only one of them.
+ *
+ * The head occupies a cache line of its own so that producers hammering it
+ * don't false-share with whatever the queue is embedded next to.
+ */
+template<typename Op>
+class mpsc_queue
+{
+    // Aligning the only member pads the whole queue to a cache line.
+    alignas(cache_line_size) std::atomic<Op*> head_{nullptr};
+
+public:
+    mpsc_queue() = default;
+    mpsc_queue(const mpsc_queue&) = delete;
+    mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+    /**
+     * Pushes @p op. May be called by any thread.
+     *
+     * @return True if the queue was empty before the push.
+     */
+    bool push(Op* op) noexcept
+    {
+        Op* head = head_.load(std::memory_order_relaxed);
+        do {
+            op->next_ = head;
+        } while(!head_.compare_exchange_weak(head, op,
+                std::memory_order_seq_cst, std::memory_order_relaxed));
+        return head == nullptr;
+    }
+
+    /** A snapshot of whether the queue is empty. */
+    bool empty() const noexcept
+    {
+        return head_.load(std::memory_order_seq_cst) == nullptr;
+    }
+
+    /**
+     * Moves all operations pushed so far to the end of @p ops, in the order in
+     * which they were pushed.
+     *
+     * @return False if there was nothing to move.
+     */
+    bool pop_all(op_queue<Op>& ops) noexcept
+    {
+        // Avoid the read-modify-write in the common, empty case.
+        if(head_.load(std::memory_order_relaxed) == nullptr) {
+            return false;
+        }
+        Op* head = head_.exchange(nullptr, std::memory_order_acquire);
+        if(head == nullptr) {
+            return false;
+        }
+
+        // The list is in LIFO order, reverse it.
+        Op* reversed = nullptr;
+        while(head) {
+            Op* next = static_cast<Op*>(head->next_);
+            head->next_ = reversed;
+            reversed = head;
+            head = next;
+        }
+        while(reversed) {
+            Op* next = static_cast<Op*>(reversed->next_);
+            ops.push(reversed);
+            reversed = next;
+        }
+        return true;
+    }
+};
+
+} // detail
+} // ft
+
+#endif
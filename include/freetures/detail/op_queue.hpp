@@ -0,0 +1,147 @@
+#ifndef FREETURES_OP_QUEUE_HPP
+#define FREETURES_OP_QUEUE_HPP
+
+namespace ft {
+namespace detail {
+
+template<typename Op> class op_queue;
+template<typename Op> class mpsc_queue;
+
+/**
+ * The base of everything that may be queued for execution by the scheduler,
+ * such as shared states of fulfilled promises.
+ *
+ * The queue node lives inside the operation itself, so enqueueing and
+ * dispatching it never allocates. Instead of a virtual function the concrete
+ * operation provides a plain function pointer, which is the only indirection
+ * paid per dispatch.
+ */
+class scheduler_op
+{
+    template<typename Op>
+    friend class op_queue;
+    template<typename Op>
+    friend class mpsc_queue;
+
+public:
+    using func_type = void (*)(scheduler_op*);
+
+private:
+    scheduler_op* next_ = nullptr;
+    func_type func_;
+
+protected:
+    explicit scheduler_op(func_type f) noexcept : func_(f) {}
+
+    // Operations are never destroyed through a pointer to this class.
+    ~scheduler_op() = default;
+
+public:
+    /** Executes the operation. The operation may be destroyed by this call. */
+    void complete()
+    {
+        func_(this);
+    }
+};
+
+/**
+ * An intrusive singly-linked FIFO queue of operations that derive from (or
+ * otherwise provide a `next_` member like) @ref scheduler_op.
+ *
+ * The queue does not own its elements.
+ */
+template<typename Op>
+class op_queue
+{
+    Op* front_ = nullptr;
+    Op* back_ = nullptr;
+
+public:
+    op_queue() = default;
+    op_queue(const op_queue&) = delete;
+    op_queue& operator=(const op_queue&) = delete;
+
+    bool empty() const noexcept { return front_ == nullptr; }
+    Op* front() noexcept { return front_; }
+
+    void push(Op* op) noexcept
+    {
+        op->next_ = nullptr;
+        if(back_) {
+            back_->next_ = op;
+            back_ = op;
+        } else {
+            front_ = back_ = op;
+        }
+    }
+
+    /** Puts @p op at the front of the queue. */
+    void push_front(Op* op) noexcept
+    {
+        op->next_ = front_;
+        front_ = op;
+        if(back_ == nullptr) {
+            back_ = op;
+        }
+    }
+
+    /** Moves all operations in @p other to the end of this queue. */
+    void push(op_queue& other) noexcept
+    {
+        if(other.front_) {
+            if(back_) {
+                back_->next_ = other.front_;
+            } else {
+                front_ = other.front_;
+            }
+            back_ = other.back_;
+            other.front_ = other.back_ = nullptr;
+        }
+    }
+
+    /** Removes and returns the first operation, or nullptr if empty. */
+    Op* pop() noexcept
+    {
+        Op* op = front_;
+        if(op) {
+            front_ = static_cast<Op*>(op->next_);
+            if(front_ == nullptr) {
+                back_ = nullptr;
+            }
+            op->next_ = nullptr;
+        }
+        return op;
+    }
+
+    /**
+     * Removes @p op from the queue, in O(n).
+     *
+     * @return False if @p op is not in the queue.
+     */
+    bool remove(Op* op) noexcept
+    {
+        Op* prev = nullptr;
+        for(Op* o = front_; o; o = static_cast<Op*>(o->next_)) {
+            if(o != op) {
+                prev = o;
+                continue;
+            }
+            if(prev) {
+                prev->next_ = op->next_;
+            } else {
+                front_ = static_cast<Op*>(op->next_);
+            }
+            if(back_ == op) {
+                back_ = prev;
+            }
+            op->next_ = nullptr;
+            return true;
+        }
+        return false;
+    }
+};
+
+} // detail
+} // ft
+
+#endif
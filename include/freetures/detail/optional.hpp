@@ -17,6 +17,14 @@
 #define TL_OPTIONAL_VERSION_MAJOR 0
 #define TL_OPTIONAL_VERSION_MINOR 2
 
+// Without exceptions, accessing an empty optional aborts instead.
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+#define TL_OPTIONAL_THROW(e) throw e
+#else
+#define TL_OPTIONAL_THROW(e) std::abort()
+#endif
+
+#include <cstdlib>
 #include <exception>
 #include <functional>
 #include <new>
@@ -1345,20 +1353,20 @@ public:
   TL_OPTIONAL_11_CONSTEXPR T &value() & {
     if (has_value())
       return this->m_value;
-    throw bad_optional_access();
+    TL_OPTIONAL_THROW(bad_optional_access());
   }
   /// \group value
   /// \synopsis constexpr const T &value() const;
   TL_OPTIONAL_11_CONSTEXPR const T &value() const & {
     if (has_value())
       return this->m_value;
-    throw bad_optional_access();
+    TL_OPTIONAL_THROW(bad_optional_access());
   }
   /// \exclude
   TL_OPTIONAL_11_CONSTEXPR T &&value() && {
     if (has_value())
       return std::move(this->m_value);
-    throw bad_optional_access();
+    TL_OPTIONAL_THROW(bad_optional_access());
   }
 
 #ifndef TL_OPTIONAL_NO_CONSTRR
@@ -1366,7 +1374,7 @@ public:
   TL_OPTIONAL_11_CONSTEXPR const T &&value() const && {
     if (has_value())
       return std::move(this->m_value);
-    throw bad_optional_access();
+    TL_OPTIONAL_THROW(bad_optional_access());
   }
 #endif
 
@@ -2241,14 +2249,14 @@ public:
   TL_OPTIONAL_11_CONSTEXPR T &value() {
     if (has_value())
       return *m_value;
-    throw bad_optional_access();
+    TL_OPTIONAL_THROW(bad_optional_access());
   }
   /// \group value
   /// \synopsis constexpr const T &value() const;
   TL_OPTIONAL_11_CONSTEXPR const T &value() const {
     if (has_value())
       return *m_value;
-    throw bad_optional_access();
+    TL_OPTIONAL_THROW(bad_optional_access());
   }
 
   /// \returns the stored value if there is one, otherwise returns `u`
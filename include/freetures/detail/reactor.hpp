@@ -1,11 +1,30 @@
 #ifndef FREETURES_REACTOR_HPP
+#define FREETURES_REACTOR_HPP
 
-#include "select_reactor.hpp"
+#include "config.hpp"
+
+#if FREETURES_HAS_IO_URING
+# include "uring_reactor.hpp"
+#elif FREETURES_HAS_EPOLL
+# include "epoll_reactor.hpp"
+#else
+# include "select_reactor.hpp"
+#endif
 
 namespace ft {
 namespace detail {
 
+/**
+ * The reactor backend of the scheduler (see FREETURES_HAS_IO_URING and
+ * FREETURES_HAS_EPOLL).
+ */
+#if FREETURES_HAS_IO_URING
+using reactor = uring_reactor;
+#elif FREETURES_HAS_EPOLL
+using reactor = epoll_reactor;
+#else
 using reactor = select_reactor;
+#endif
 
 } // detail
 } // ft
@@ -0,0 +1,80 @@
+#ifndef FREETURES_REACTOR_OP_HPP
+#define FREETURES_REACTOR_OP_HPP
+
+#include <cstddef>
+#include <system_error>
+
+#include "op_queue.hpp"
+
+namespace ft {
+namespace detail {
+
+/**
+ * An I/O operation on a descriptor, which waits in the reactor until the
+ * descriptor is ready for it.
+ *
+ * Besides the function of a @ref scheduler_op, which completes the operation
+ * (i.e. fulfills its promise, and frees the operation), a reactor operation
+ * has a function that attempts the non-blocking system call itself. The
+ * reactor calls it whenever the descriptor may be ready, until it no longer
+ * reports that the call would block. Completing the operation is then left to
+ * whoever performed it, outside the reactor's locks.
+ */
+class reactor_op : public scheduler_op
+{
+public:
+    /**
+     * Attempts the operation. Returns false if it would block, and true once
+     * it's done, having stored its outcome in the operation.
+     */
+    using perform_func = bool (*)(reactor_op*);
+
+    /** The kinds of readiness an operation may wait for. */
+    enum op_type
+    {
+        read_op,
+        write_op,
+        except_op,
+        max_ops,
+    };
+
+    // The buffer of an operation that transfers a single buffer to or from
+    // its descriptor, or null. It lets a completion-based backend (see
+    // uring_reactor) submit the whole operation to the kernel, rather than
+    // wait for readiness and call the perform function.
+    void* buffer_ = nullptr;
+    std::size_t buffer_size_ = 0;
+
+    // The outcome of the operation: set by the perform function, by the
+    // reactor if it performed the operation itself, or if the operation is
+    // aborted, e.g. because its descriptor is deregistered.
+    std::error_code ec_;
+    std::size_t bytes_transferred_ = 0;
+
+    // Set by the reactor's cancel_op, under the reactor's lock, so that an
+    // operation whose cancellation arrives before it's queued is aborted
+    // rather than queued, and one in the kernel's hands isn't resubmitted.
+    bool cancelled_ = false;
+
+private:
+    perform_func perform_;
+
+protected:
+    reactor_op(perform_func perform, func_type complete) noexcept
+        : scheduler_op(complete)
+        , perform_(perform)
+    {}
+
+    ~reactor_op() = default;
+
+public:
+    bool perform()
+    {
+        return perform_(this);
+    }
+};
+
+} // detail
+} // ft
+
+#endif
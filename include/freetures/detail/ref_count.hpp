@@ -0,0 +1,123 @@
+#ifndef FREETURES_REF_COUNT_HPP
+#define FREETURES_REF_COUNT_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+#include "config.hpp"
+
+namespace ft {
+namespace detail {
+
+/**
+ * An intrusive reference count. If @p Atomic is false, it's a plain integer,
+ * which may only be used by a single thread.
+ */
+template<bool Atomic>
+class basic_ref_count;
+
+template<>
+class basic_ref_count<true>
+{
+    std::atomic<std::size_t> count_;
+
+public:
+    explicit basic_ref_count(std::size_t n = 1) noexcept : count_(n) {}
+
+    void increment() noexcept
+    {
+        count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /** @return True if this dropped the last reference. */
+    bool decrement() noexcept
+    {
+        return count_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+};
+
+template<>
+class basic_ref_count<false>
+{
+    std::size_t count_;
+
+public:
+    explicit basic_ref_count(std::size_t n = 1) noexcept : count_(n) {}
+
+    void increment() noexcept
+    {
+        ++count_;
+    }
+
+    bool decrement() noexcept
+    {
+        return --count_ == 0;
+    }
+};
+
+using ref_count = basic_ref_count<FREETURES_HAS_THREADS != 0>;
+
+/**
+ * A pointer that shares ownership of an object that counts its own
+ * references, through its `add_ref` and `release` member functions.
+ *
+ * Unlike `std::shared_ptr` it is a single pointer, and there is no separate
+ * control block to allocate.
+ */
+template<typename T>
+class intrusive_ptr
+{
+    T* p_ = nullptr;
+
+public:
+    intrusive_ptr() = default;
+
+    /** Adopts @p p, i.e. takes over the reference that the caller holds. */
+    explicit intrusive_ptr(T* p) noexcept : p_(p) {}
+
+    intrusive_ptr(const intrusive_ptr& other) noexcept : p_(other.p_)
+    {
+        if(p_) {
+            p_->add_ref();
+        }
+    }
+
+    intrusive_ptr(intrusive_ptr&& other) noexcept : p_(other.p_)
+    {
+        other.p_ = nullptr;
+    }
+
+    intrusive_ptr& operator=(intrusive_ptr other) noexcept
+    {
+        std::swap(p_, other.p_);
+        return *this;
+    }
+
+    ~intrusive_ptr()
+    {
+        if(p_) {
+            p_->release();
+        }
+    }
+
+    T* get() const noexcept { return p_; }
+    T& operator*() const noexcept { return *p_; }
+    T* operator->() const noexcept { return p_; }
+    explicit operator bool() const noexcept { return p_ != nullptr; }
+
+    void reset() noexcept
+    {
+        intrusive_ptr().swap(*this);
+    }
+
+    void swap(intrusive_ptr& other) noexcept
+    {
+        std::swap(p_, other.p_);
+    }
+};
+
+} // detail
+} // ft
+
+#endif
@@ -1,92 +1,826 @@
 #ifndef FREETURES_SCHEDULER_IMPL_HPP
 #define FREETURES_SCHEDULER_IMPL_HPP
 
-#include <deque>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
 #include <memory>
+#include <mutex>
 
 #include "../future.hpp"
 #include "../promise.hpp"
 #include "../time.hpp"
+#include "cancellation_state.hpp"
+#include "config.hpp"
+#include "mpsc_queue.hpp"
+#include "op_queue.hpp"
 #include "reactor.hpp"
+#include "slab_allocator.hpp"
+#include "timer_wheel.hpp"
 #include "type_traits.hpp"
+#include "work_stealing_deque.hpp"
 
 namespace ft {
 namespace detail {
 
-struct ready_promise
-{
-    virtual void invoke_handler() = 0;
-    virtual ~ready_promise() {}
-};
-
-template<typename T>
-struct concrete_ready_promise final : public ready_promise
-{
-    promise<T> p;
-
-    void invoke_handler() override
-    {
-        p.invoke_handler();
-    }
-};
+class repeat_op;
 
 /**
  * @brief Concrete scheduler implementation.
  */
 class scheduler
 {
-    // The queue of fulfilled promises that are ready to be delivered.
-    std::deque<std::unique_ptr<ready_promise>> ready_promises_;
+    // The maximum number of injected operations a worker moves to its own deque
+    // at a time.
+    static constexpr int injected_batch_size = 32;
+
+    // The number of operations executed between checks for expired timers
+    // while there is a steady supply of ready operations.
+    static constexpr int timer_check_interval = 64;
+
+    // The per-thread state of a thread executing run() when the scheduler is
+    // run by multiple threads.
+    struct worker
+    {
+        // Operations made ready by this worker's thread. Other workers steal
+        // from here once they run out of work.
+        work_stealing_deque<scheduler_op> ops;
+        std::atomic<bool> in_use{false};
+    };
+
+    // Identifies the scheduler (and worker) whose run() the calling thread is
+    // executing, if any.
+    struct thread_context
+    {
+        scheduler* owner = nullptr;
+        worker* w = nullptr;
+        // The number of continuations being executed inline, one within
+        // another, by this thread.
+        std::size_t inline_depth = 0;
+    };
+
+    // The number of threads that may execute run() concurrently. If it's 1,
+    // none of the worker machinery below is used.
+    const std::size_t concurrency_hint_;
+
+    // How deeply continuations may be nested when executed inline. Zero
+    // disables inline execution.
+    std::size_t max_inline_depth_ = 0;
+
+    // The memory of the shared states of promises associated with this
+    // scheduler. It's declared first so that it outlives the queues that may
+    // still hold states.
+    slab_allocator allocator_;
+
+    // The queue of fulfilled promises that are ready to be delivered. The queue
+    // is intrusive: its nodes are the shared states themselves, so neither
+    // posting a ready promise nor dispatching it allocates. It is only ever
+    // touched by the thread running the scheduler, and only when run by a
+    // single thread (workers have their own deques).
+    op_queue<scheduler_op> ready_ops_;
+
+    // Operations posted by threads other than the ones running the scheduler,
+    // as well as those that didn't fit in a worker's deque. Posting to it is
+    // lock-free, and it sits on its own cache line.
+    mpsc_queue<scheduler_op> injected_ops_;
+
     reactor reactor_;
+    std::atomic<bool> stopped_{false};
+
+    // Armed timers. When run by a single thread, the wheel is only touched by
+    // that thread, and timers armed by other threads are handed over through
+    // injected_timers_. When run by multiple threads it is guarded by
+    // timers_mutex_.
+    timer_wheel timers_;
+    mpsc_queue<timer_op> injected_timers_;
+    std::mutex timers_mutex_;
+
+    // The tick until which a thread blocked in the reactor sleeps. A timer
+    // armed by another thread only needs to interrupt it if it's due earlier.
+    std::atomic<timer_wheel::tick_type> reactor_wakeup_tick_{timer_wheel::max_ticks};
+
+    // Whether a thread is (about to be) blocked in the reactor, in which case a
+    // post from another thread has to interrupt it. Posters race to clear it,
+    // so a burst of posts costs a single interrupt.
+    std::atomic<bool> reactor_blocked_{false};
+    std::atomic<bool> polling_reactor_{false};
+
+    // When run by a single thread, this is the number of work guards and armed
+    // timers; when run by multiple threads it also includes the ready
+    // operations that have not yet been executed. run() returns once it drops
+    // to zero.
+    std::atomic<std::size_t> outstanding_work_{0};
+
+    // Only used when run by multiple threads.
+    std::unique_ptr<worker[]> workers_;
+    // Operations taken from injected_ops_ but not yet handed to a worker.
+    // Only the thread that holds consuming_injected_ops_ may access it, which
+    // keeps injected_ops_ single-consumer.
+    op_queue<scheduler_op> injected_batch_;
+    std::atomic<bool> consuming_injected_ops_{false};
+    std::atomic<bool> has_injected_batch_{false};
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::atomic<std::size_t> num_idle_workers_{0};
+
+    // The repetitions started by repeat() that are still running, which the
+    // scheduler frees if they're never cancelled.
+    repeat_op* repeats_ = nullptr;
+    std::mutex repeats_mutex_;
+
+    // Set by the destructor (see is_shutting_down).
+    bool shutting_down_ = false;
 
 public:
-    scheduler()
-        : reactor_(*this)
-    {}
+    /**
+     * @param concurrency_hint The number of threads that will call @ref run.
+     * Values above 1 enable work-stealing between those threads.
+     */
+    explicit scheduler(std::size_t concurrency_hint = 1)
+        : concurrency_hint_(concurrency_hint > 0 ? concurrency_hint : 1)
+        , reactor_(*this)
+    {
+        assert((FREETURES_HAS_THREADS || !is_concurrent())
+                && "running a scheduler on multiple threads requires FREETURES_HAS_THREADS");
+        if(is_concurrent()) {
+            workers_.reset(new worker[concurrency_hint_]);
+        }
+    }
+
+    /**
+     * Destroys or cancels the operations that are still pending: the ready
+     * ones, the timers, the operations of the reactor, the coroutines
+     * spawned on the scheduler and the repetitions. Their promises are
+     * abandoned, so the futures that depend on them are cancelled.
+     *
+     * No other thread may use the scheduler by then.
+     */
+    ~scheduler();
+
+    /**
+     * Whether the scheduler is being destroyed, in which case operations
+     * that are executed must not invoke their handlers (other than those for
+     * cancellation), but drop them, or cancel what they were waiting for.
+     */
+    bool is_shutting_down() const noexcept
+    {
+        return shutting_down_;
+    }
 
     reactor& get_reactor() noexcept
     {
         return reactor_;
     }
 
+    slab_allocator& get_allocator() noexcept
+    {
+        return allocator_;
+    }
+
     template<
         typename F,
-        typename R = typename callable_traits<F, void>::inner_result_type,
-        typename = typename std::enable_if<is_callable<F>::value>::type
+        typename R = typename detail::non_void<
+            typename callable_traits<F, void>::inner_result_type>::type,
+        typename = typename std::enable_if<is_callable<F()>::value>::type
     > future<R> post(F&& f)
     {
+        // A posted function is simply the continuation of an already fulfilled
+        // void promise, so it goes through the same ready queue as any other
+        // completion.
+        typename dependent_type<promise<null_tag>, F>::type p(*this);
+        auto future = p.get_future().then(
+            [f = std::forward<F>(f)](null_tag) mutable { return f(); });
+        p.set_value(null_tag());
+        post_ready_promise(std::move(p));
+        return future;
     }
 
     template<
         typename F,
-        typename R = typename callable_traits<F, void>::inner_result_type,
-        typename = typename std::enable_if<is_callable<F>::value>::type
-    > future<R> defer(F&& f, duration delay)
-    {
-        //return wait(delay).then(std::forward(f));
-    }
+        typename R = typename detail::non_void<
+            typename callable_traits<F, void>::inner_result_type>::type,
+        typename = typename std::enable_if<is_callable<F()>::value>::type
+    > future<R> defer(F&& f, duration delay,
+            intrusive_ptr<cancellation_state> cancellation = {});
 
     template<
         typename F,
-        typename = typename std::enable_if<is_callable<F>::value>::type
-    > void repeat(F&& f, duration frequency)
-    {
-    }
+        typename = typename std::enable_if<is_callable<F()>::value
+            || is_callable<F(std::size_t)>::value>::type
+    > void repeat(F&& f, duration frequency,
+            catch_up policy = catch_up::fire_all,
+            intrusive_ptr<cancellation_state> cancellation = {});
+
+    /** Links @p r into, or unlinks it from, the list of repetitions. */
+    void add_repeat(repeat_op& r);
+    void remove_repeat(repeat_op& r);
 
-    //void_future wait(duration delay)
-    //{
-    //}
+    future<null_tag> wait(duration delay,
+            intrusive_ptr<cancellation_state> cancellation = {});
 
+    /**
+     * @brief Executes ready operations until there are none left or the
+     * scheduler is stopped.
+     *
+     * If the scheduler was constructed with a concurrency hint of N, up to N
+     * threads may call this function, each of which gets its own deque of
+     * ready operations, stealing from the others' when it runs dry. Additional
+     * threads only execute shared and stolen work.
+     *
+     * As long as there is outstanding work (see @ref work_started), this
+     * function waits in the reactor for more instead of returning.
+     */
     void run()
     {
+        if(is_concurrent()) {
+            run_concurrently();
+            return;
+        }
+
+        thread_context_guard context(*this, nullptr);
+        // Only this thread touches the pool's owner lists while it runs.
+        slab_allocator::owner_guard pool_owner(allocator_);
+        int ops_until_timer_check = timer_check_interval;
+        while(!stopped_.load(std::memory_order_relaxed)) {
+            // Pick up the operations posted by other threads.
+            injected_ops_.pop_all(ready_ops_);
+            scheduler_op* op = ready_ops_.pop();
+            if(op == nullptr) {
+                process_timers(false);
+                if(!ready_ops_.empty()) {
+                    continue;
+                }
+                if(outstanding_work_.load(std::memory_order_acquire) > 0) {
+                    poll_reactor(true);
+                } else {
+                    poll_reactor(false);
+                    if(ready_ops_.empty() && injected_ops_.empty()) {
+                        break;
+                    }
+                }
+                continue;
+            }
+            op->complete();
+            if(--ops_until_timer_check == 0) {
+                ops_until_timer_check = timer_check_interval;
+                process_timers(false);
+            }
+        }
     }
 
+    /**
+     * @brief Makes all threads executing @ref run return as soon as possible.
+     * Operations not yet executed are kept until @ref run is called again,
+     * after a call to @ref restart.
+     *
+     * May be called from any thread.
+     */
     void stop()
     {
+        stopped_.store(true, std::memory_order_seq_cst);
+        if(is_concurrent()) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            wakeup_.notify_all();
+        }
+        interrupt_blocked_reactor();
+    }
+
+    /** @brief Prepares a stopped scheduler to be run again. */
+    void restart()
+    {
+        stopped_.store(false, std::memory_order_release);
+    }
+
+    /**
+     * @brief Tells the scheduler that there is work outside of it, e.g. on
+     * another thread, that may still post operations, so that @ref run waits
+     * for them rather than returning.
+     *
+     * Must be paired with a call to @ref work_finished. May be called from any
+     * thread.
+     */
+    void work_started() noexcept
+    {
+        outstanding_work_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /** @brief Counterpart of @ref work_started. May be called from any thread. */
+    void work_finished()
+    {
+        if(outstanding_work_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            // Nothing left to do: let the waiting threads return.
+            if(is_concurrent()) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                wakeup_.notify_all();
+            }
+            interrupt_blocked_reactor();
+        }
+    }
+
+    /** Whether the calling thread is executing this scheduler's @ref run. */
+    bool running_in_this_thread() const noexcept
+    {
+        return this_thread().owner == this;
     }
 
+    /** The scheduler whose @ref run the calling thread is executing, if any. */
+    static scheduler* current() noexcept
+    {
+        return this_thread().owner;
+    }
+
+    /** Whether the scheduler may be run by multiple threads. */
+    bool is_concurrent() const noexcept
+    {
+        return concurrency_hint_ > 1;
+    }
+
+    /**
+     * @brief Arms @p t to be posted as a ready operation once @p expiry has
+     * been reached (at the wheel's resolution, never earlier).
+     *
+     * Armed timers count as outstanding work. May be called from any thread,
+     * but the caller must not touch @p t again until it has expired or been
+     * cancelled.
+     */
+    void start_timer(timer_op& t, time_point expiry)
+    {
+        const auto when = timers_.expiry_tick(expiry);
+        t.set_expiry(when);
+        work_started();
+        if(!is_concurrent() && !running_in_this_thread()) {
+            injected_timers_.push(&t);
+            interrupt_blocked_reactor(when);
+            return;
+        }
+
+        bool inserted;
+        bool interrupt = false;
+        {
+            std::unique_lock<std::mutex> lock = lock_timers();
+            inserted = timers_.insert(t);
+            // This must be decided under the lock, see poll_reactor.
+            interrupt = inserted
+                && when < reactor_wakeup_tick_.load(std::memory_order_seq_cst);
+        }
+        if(!inserted) {
+            // Already due, so don't bother with the wheel.
+            post_ready_op(&t);
+            outstanding_work_.fetch_sub(1, std::memory_order_relaxed);
+        } else if(interrupt) {
+            interrupt_blocked_reactor();
+        }
+    }
+
+    /**
+     * @brief Disarms @p t if it has not yet expired, in O(1).
+     *
+     * When run by a single thread this must be called by the thread running
+     * the scheduler (or while it's not running), and first moves the timers
+     * armed by other threads into the wheel, so that they can be disarmed
+     * too.
+     *
+     * @return False if @p t was no longer armed, in which case it has been or
+     * is about to be posted.
+     */
+    bool cancel_timer(timer_op& t)
+    {
+        if(!is_concurrent()) {
+            // The timer may have been armed by another thread, or before run
+            // was called, and not have made it into the wheel yet.
+            collect_injected_timers();
+        }
+        {
+            std::unique_lock<std::mutex> lock = lock_timers();
+            if(!timers_.remove(t)) {
+                return false;
+            }
+        }
+        work_finished();
+        return true;
+    }
+
+    /**
+     * @brief Enqueues the fulfilled promise @p p for handler invocation by
+     * @ref run.
+     *
+     * The shared state of @p p is kept alive until its handler has been
+     * invoked. May be called from any thread.
+     */
     template<typename T>
     void post_ready_promise(promise<T> p);
+
+    /**
+     * @brief Like @ref post_ready_promise, but invokes the handler right away
+     * if this is the thread running the scheduler and the inline depth limit
+     * (see @ref set_max_inline_depth) has not been reached.
+     *
+     * Must only be called by handlers, never directly by functions whose
+     * callers rely on their handlers not being invoked from within them.
+     */
+    template<typename T>
+    void dispatch_ready_promise(promise<T> p);
+
+    /**
+     * @brief Lets continuations whose result is ready be executed inline, by
+     * the handler that produced the result, rather than going through the
+     * ready queue, for up to @p depth nested continuations per thread. Deeper
+     * continuations are enqueued as usual, which unwinds the stack.
+     *
+     * Zero, the default, disables inline execution. Must not be called while
+     * the scheduler is running.
+     */
+    void set_max_inline_depth(std::size_t depth) noexcept
+    {
+        max_inline_depth_ = depth;
+    }
+
+    /**
+     * @brief Enqueues an operation that is ready to be executed by @ref run.
+     *
+     * May be called from any thread. Posts from threads not running the
+     * scheduler take a lock-free path and only make a system call if the
+     * scheduler is blocked waiting for events.
+     */
+    void post_ready_op(scheduler_op* op)
+    {
+        const thread_context& context = this_thread();
+        if(!is_concurrent()) {
+            if(context.owner == this) {
+                ready_ops_.push(op);
+            } else {
+                injected_ops_.push(op);
+                interrupt_blocked_reactor();
+            }
+            return;
+        }
+
+        outstanding_work_.fetch_add(1, std::memory_order_relaxed);
+        if(context.owner != this || context.w == nullptr
+                || !context.w->ops.push(op)) {
+            injected_ops_.push(op);
+        }
+        wake_one();
+    }
+
+private:
+    class thread_context_guard
+    {
+        thread_context prev_;
+
+    public:
+        thread_context_guard(scheduler& s, worker* w)
+            : prev_(this_thread())
+        {
+            this_thread().owner = &s;
+            this_thread().w = w;
+            this_thread().inline_depth = 0;
+        }
+
+        ~thread_context_guard()
+        {
+            this_thread() = prev_;
+        }
+    };
+
+    // Accounts for a continuation executed inline for as long as it exists.
+    class inline_depth_guard
+    {
+        thread_context& context_;
+
+    public:
+        explicit inline_depth_guard(thread_context& context) noexcept
+            : context_(context)
+        {
+            ++context_.inline_depth;
+        }
+
+        ~inline_depth_guard()
+        {
+            --context_.inline_depth;
+        }
+    };
+
+    /**
+     * Whether the calling thread may execute another continuation inline,
+     * which it must then do within an @ref inline_depth_guard.
+     */
+    bool can_execute_inline(const thread_context& context) const noexcept
+    {
+        return max_inline_depth_ > 0
+            && context.owner == this
+            && context.inline_depth < max_inline_depth_;
+    }
+
+    static thread_context& this_thread() noexcept
+    {
+        static thread_local thread_context context;
+        return context;
+    }
+
+    std::unique_lock<std::mutex> lock_timers()
+    {
+        if(is_concurrent()) {
+            return std::unique_lock<std::mutex>(timers_mutex_);
+        }
+        return std::unique_lock<std::mutex>();
+    }
+
+    /**
+     * Moves the timers armed by other threads into the wheel, or to the ready
+     * queue if they're already due. Only for a scheduler run by a single
+     * thread, by that thread (or while it's not running).
+     */
+    void collect_injected_timers()
+    {
+        op_queue<timer_op> injected;
+        injected_timers_.pop_all(injected);
+        while(timer_op* t = injected.pop()) {
+            if(!timers_.insert(*t)) {
+                outstanding_work_.fetch_sub(1, std::memory_order_relaxed);
+                ready_ops_.push(t);
+            }
+        }
+    }
+
+    /**
+     * Makes the timers due by now ready, in one batch.
+     *
+     * @param try_only When run by multiple threads, gives up rather than wait
+     * if another thread is processing timers.
+     */
+    void process_timers(bool try_only)
+    {
+        std::unique_lock<std::mutex> lock;
+        if(is_concurrent()) {
+            lock = std::unique_lock<std::mutex>(timers_mutex_, std::defer_lock);
+            if(try_only) {
+                if(!lock.try_lock()) {
+                    return;
+                }
+            } else {
+                lock.lock();
+            }
+        } else {
+            collect_injected_timers();
+        }
+
+        if(timers_.empty()) {
+            return;
+        }
+
+        op_queue<scheduler_op> expired;
+        const auto num_expired = timers_.advance(
+                timers_.current_tick(clock::now()), expired);
+        if(lock.owns_lock()) {
+            lock.unlock();
+        }
+        if(num_expired == 0) {
+            return;
+        }
+
+        if(!is_concurrent()) {
+            // Expired timers are no longer outstanding work, but the ready
+            // operations they became keep run() busy.
+            ready_ops_.push(expired);
+            outstanding_work_.fetch_sub(num_expired, std::memory_order_relaxed);
+        } else {
+            // The timers' share of outstanding work carries over to the ready
+            // operations they became.
+            worker* w = this_thread().w;
+            while(scheduler_op* op = expired.pop()) {
+                if(w == nullptr || !w->ops.push(op)) {
+                    injected_ops_.push(op);
+                }
+            }
+            wake_one();
+        }
+    }
+
+    /**
+     * Polls the reactor for events, if no other thread is doing so, and waits
+     * for them if @p block is true and there is nothing else to do, but not
+     * beyond the slot of the next timer that may become due.
+     */
+    void poll_reactor(bool block)
+    {
+        if(polling_reactor_.exchange(true, std::memory_order_acquire)) {
+            return;
+        }
+        duration timeout = duration::zero();
+        if(block) {
+            // Announce that we're about to block, and until when, then check
+            // once more for work: a poster either sees the flag and interrupts
+            // the reactor, or we see its operation here. Timers armed
+            // concurrently are ordered against this by the timers' lock.
+            timer_wheel::tick_type wakeup_tick;
+            {
+                std::unique_lock<std::mutex> lock = lock_timers();
+                wakeup_tick = timers_.next_expiration();
+                reactor_wakeup_tick_.store(wakeup_tick, std::memory_order_seq_cst);
+                reactor_blocked_.store(true, std::memory_order_seq_cst);
+            }
+            if(!stopped_.load(std::memory_order_seq_cst)
+                    && outstanding_work_.load(std::memory_order_seq_cst) > 0
+                    && !has_ready_ops()) {
+                // A reactor with a timerfd wakes up for the next timer by
+                // itself, and is only re-armed when that timer changes.
+                if(wakeup_tick == timer_wheel::max_ticks) {
+                    reactor_.arm_timer(time_point::max());
+                    timeout = duration::max();
+                } else {
+                    const time_point expiry = timers_.to_time_point(wakeup_tick);
+                    if(reactor_.arm_timer(expiry)) {
+                        timeout = duration::max();
+                    } else {
+                        timeout = expiry - clock::now();
+                        if(timeout < duration::zero()) {
+                            timeout = duration::zero();
+                        }
+                    }
+                }
+            }
+        }
+        reactor_.run(timeout);
+        reactor_blocked_.store(false, std::memory_order_relaxed);
+        polling_reactor_.store(false, std::memory_order_release);
+    }
+
+    void interrupt_blocked_reactor()
+    {
+        if(reactor_blocked_.load(std::memory_order_seq_cst)
+                && reactor_blocked_.exchange(false, std::memory_order_acq_rel)) {
+            reactor_.interrupt();
+        }
+    }
+
+    /** Interrupts the reactor only if it would sleep past tick @p when. */
+    void interrupt_blocked_reactor(timer_wheel::tick_type when)
+    {
+        if(when < reactor_wakeup_tick_.load(std::memory_order_seq_cst)) {
+            interrupt_blocked_reactor();
+        }
+    }
+
+    bool has_ready_ops() const noexcept
+    {
+        if(!injected_ops_.empty()
+                || has_injected_batch_.load(std::memory_order_acquire)
+                || !injected_timers_.empty()) {
+            return true;
+        }
+        for(std::size_t i = 0; i < (is_concurrent() ? concurrency_hint_ : 0); ++i) {
+            if(!workers_[i].ops.empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run_concurrently()
+    {
+        worker* w = claim_worker();
+        thread_context_guard context(*this, w);
+        int ops_until_timer_check = timer_check_interval;
+        while(!stopped_.load(std::memory_order_acquire)) {
+            scheduler_op* op = next_op(w);
+            if(op == nullptr) {
+                if(outstanding_work_.load(std::memory_order_acquire) == 0) {
+                    break;
+                }
+                // One of the idle threads waits in the reactor (and takes care
+                // of timers), the others sleep until they are handed work.
+                if(polling_reactor_.load(std::memory_order_relaxed)) {
+                    wait_for_work();
+                } else {
+                    process_timers(false);
+                    poll_reactor(true);
+                }
+                continue;
+            }
+            op->complete();
+            work_finished();
+            if(--ops_until_timer_check == 0) {
+                ops_until_timer_check = timer_check_interval;
+                process_timers(true);
+            }
+        }
+        release_worker(w);
+    }
+
+    scheduler_op* next_op(worker* w)
+    {
+        scheduler_op* op = nullptr;
+        if(w) {
+            op = w->ops.pop();
+            if(op) {
+                return op;
+            }
+        }
+
+        op = next_injected_op(w);
+        if(op) {
+            return op;
+        }
+
+        // Start stealing from our right neighbour so that not every idle
+        // worker hammers the same deque.
+        const std::size_t self = w ? w - workers_.get() : 0;
+        for(std::size_t i = 1; i <= concurrency_hint_; ++i) {
+            worker& victim = workers_[(self + i) % concurrency_hint_];
+            if(&victim != w) {
+                op = victim.ops.steal();
+                if(op) {
+                    return op;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    scheduler_op* next_injected_op(worker* w)
+    {
+        if((injected_ops_.empty()
+                    && !has_injected_batch_.load(std::memory_order_acquire))
+                || consuming_injected_ops_.exchange(true, std::memory_order_acquire)) {
+            return nullptr;
+        }
+
+        injected_ops_.pop_all(injected_batch_);
+        scheduler_op* op = injected_batch_.pop();
+        // Move a share of the rest to our deque, where other workers may steal
+        // it.
+        bool moved_some = false;
+        for(int i = 0; w && i < injected_batch_size; ++i) {
+            scheduler_op* next = injected_batch_.pop();
+            if(next == nullptr) {
+                break;
+            }
+            if(!w->ops.push(next)) {
+                injected_batch_.push_front(next);
+                break;
+            }
+            moved_some = true;
+        }
+        has_injected_batch_.store(!injected_batch_.empty(), std::memory_order_release);
+        consuming_injected_ops_.store(false, std::memory_order_release);
+
+        if(moved_some) {
+            wake_one();
+        }
+        return op;
+    }
+
+    void wait_for_work()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // This pairs with the fence in wake_one: either the poster sees us
+        // idle and notifies, or we see its operation below.
+        num_idle_workers_.fetch_add(1, std::memory_order_seq_cst);
+        while(!stopped_.load(std::memory_order_acquire)
+                && outstanding_work_.load(std::memory_order_acquire) > 0
+                && !has_ready_ops()) {
+            wakeup_.wait(lock);
+        }
+        num_idle_workers_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void wake_one()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(num_idle_workers_.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            wakeup_.notify_one();
+        } else {
+            interrupt_blocked_reactor();
+        }
+    }
+
+    worker* claim_worker() noexcept
+    {
+        for(std::size_t i = 0; i < concurrency_hint_; ++i) {
+            bool expected = false;
+            if(workers_[i].in_use.compare_exchange_strong(expected, true,
+                    std::memory_order_acquire)) {
+                return &workers_[i];
+            }
+        }
+        return nullptr;
+    }
+
+    void release_worker(worker* w)
+    {
+        if(w == nullptr) {
+            return;
+        }
+        // Hand any operations left behind (e.g. due to stop()) to the shared
+        // queue, so that they're not lost to the next run().
+        while(scheduler_op* op = w->ops.pop()) {
+            injected_ops_.push(op);
+        }
+        w->in_use.store(false, std::memory_order_release);
+    }
 };
 
 } // detail
@@ -1,9 +1,21 @@
 #ifndef FREETURES_SELECT_INTERRUPTER_HPP
 #define FREETURES_SELECT_INTERRUPTER_HPP
 
+#include <cerrno>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../error.hpp"
+
 namespace ft {
 namespace detail {
 
+/**
+ * Makes a blocking select call return by writing to a pipe whose read end is
+ * in the selector's read set.
+ */
 class select_interrupter
 {
     int read_descriptor_ = -1;
@@ -12,11 +24,44 @@ class select_interrupter
 public:
     select_interrupter()
     {
-        // TODO open descriptors
+        int fds[2];
+        if(::pipe(fds) != 0) {
+            throw_error(std::error_code(errno, std::system_category()),
+                    "select_interrupter");
+        }
+        read_descriptor_ = fds[0];
+        write_descriptor_ = fds[1];
+        for(const int fd : fds) {
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+            ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+    }
+
+    select_interrupter(const select_interrupter&) = delete;
+    select_interrupter& operator=(const select_interrupter&) = delete;
+
+    ~select_interrupter()
+    {
+        ::close(read_descriptor_);
+        ::close(write_descriptor_);
+    }
+
+    /** Makes the read descriptor readable. May be called by any thread. */
+    void interrupt()
+    {
+        const char byte = 0;
+        // If the pipe is full, the selector is bound to wake up anyway.
+        const auto result = ::write(write_descriptor_, &byte, 1);
+        (void)result;
+    }
+
+    /** Drains the pipe so that the read descriptor is no longer readable. */
+    void reset()
+    {
+        char buffer[64];
+        while(::read(read_descriptor_, buffer, sizeof(buffer)) > 0) {}
     }
 
-    void interrupt();
-    void reset();
     int read_descriptor() { return read_descriptor_; }
 };
 
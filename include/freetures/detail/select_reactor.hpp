@@ -1,33 +1,79 @@
 #ifndef FREETURES_SELECT_REACTOR_HPP
 #define FREETURES_SELECT_REACTOR_HPP
 
-#include <string>
+#include "config.hpp"
 
-#include "../promise.hpp"
-#include "../future.hpp"
-#include "select_interrupter.hpp"
+#include <cstddef>
+#include <mutex>
+#include <system_error>
 
 #include <sys/select.h>
 
+#include "../time.hpp"
+#include "interrupter.hpp"
+#include "op_queue.hpp"
+#include "reactor_op.hpp"
+#include "timerfd_timer.hpp"
+
 namespace ft {
 namespace detail {
 
 class scheduler;
 
-struct descriptor_data
+/** The reactor's state of a descriptor registered with a @ref select_reactor. */
+class descriptor_data
 {
-    int descriptor;
-    // operations
+    friend class select_reactor;
+
+    int descriptor_;
+    // The operations started on the descriptor, by kind, which wait for it to
+    // become ready.
+    op_queue<reactor_op> op_queues_[reactor_op::max_ops];
+    // Links the registered descriptors.
+    descriptor_data* prev_ = nullptr;
+    descriptor_data* next_ = nullptr;
+
+    explicit descriptor_data(int descriptor) : descriptor_(descriptor) {}
 };
 
+/**
+ * A reactor backed by select, which is available wherever descriptors are,
+ * but which hands the kernel every awaited descriptor on each wait, and only
+ * those below FD_SETSIZE.
+ *
+ * Operations are speculative: one started on a descriptor with nothing queued
+ * before it is attempted right away, as the descriptor is likely ready (e.g.
+ * the reply to a command is already waiting), and only an operation that
+ * would block is queued and waits for select. Operations may be started by
+ * any thread; the reactor is run by one thread at a time (see @ref
+ * scheduler::poll_reactor).
+ *
+ * The operations of each descriptor wait in a FIFO queue per kind of
+ * readiness, and when select reports the descriptor ready, the reactor
+ * performs as many of them as the descriptor allows, rather than one per
+ * select call. Queued writes are gathered into a single writev call.
+ */
 class select_reactor
 {
-    enum op
+#if FREETURES_HAS_THREADS
+    using mutex_type = std::mutex;
+#else
+    struct mutex_type
     {
-        read,
-        write,
-        except,
+        void lock() noexcept {}
+        void unlock() noexcept {}
     };
+#endif
+
+public:
+    using op_type = reactor_op::op_type;
+
+    /** What an I/O object keeps of its registration. */
+    using per_descriptor_data = descriptor_data*;
+
+private:
+    // The most writes gathered into a single writev call.
+    static constexpr int max_gathered_writes = 16;
 
     // A reference to the scheduler to post ready promises for completion
     // handler invocation.
@@ -35,57 +81,152 @@ class select_reactor
 
     // A call to select will block until there is a ready descriptor, but we may
     // need to unblock the thread to handle events outside the reactor. For
-    // this, we employ an interrupter, which is simply a pair of loopback
-    // sockets, where the read side will be passed to select and when an
-    // interrupt is needed, we write to the other end of the socket, making the
-    // select call return.
-    select_interrupter interrupter_;
+    // this, we employ an interrupter, whose read descriptor is passed to
+    // select, and which makes it readable when an interrupt is needed, making
+    // the select call return.
+    interrupter interrupter_;
+#if FREETURES_HAS_TIMERFD
+    // Becomes readable when the next timer is due, so that select need not
+    // time out.
+    timerfd_timer timer_;
+#endif
+
+    // Guards the registered descriptors, their operation queues and the
+    // master sets.
+    mutex_type mutex_;
+    descriptor_data* descriptors_ = nullptr;
 
-    // A set of file descriptor sets corresponding to the 3 types of operations.
-    fd_set fd_sets_[3];
+    // The descriptors to select for each kind of operation, i.e. those with
+    // operations of that kind queued, the interrupter and the timer. They're
+    // kept up to date as operations are queued and dequeued, along with the
+    // highest descriptor in any of them.
+    fd_set master_sets_[reactor_op::max_ops];
+    int max_descriptor_;
 
-    bool stopping_ = false;
+    // The copies of the master sets handed to select, which leaves the ready
+    // descriptors in them.
+    fd_set fd_sets_[reactor_op::max_ops];
 
 public:
-    select_reactor(scheduler& s)
-        : scheduler_(s)
-    {}
-
-    //void_future start_read_op(descriptor_data& data)
-    //{
-        //// if shutting down, post immediate completion with error
-        //// enqueue operation in fd_sets_ and if its the first operation for this
-        //// descriptor, we need to interrupt the selector (because otherwise its
-        //// not going to be in the fd_set used by select and we're not going to
-        //// learn about any events for this descriptor)
-    //}
-
-    //void_future start_write_op(descriptor_data& data)
-    //{
-    //}
+    explicit select_reactor(scheduler& s);
+
+    select_reactor(const select_reactor&) = delete;
+    select_reactor& operator=(const select_reactor&) = delete;
+
+    /**
+     * Registers @p descriptor, which must be in non-blocking mode, with the
+     * reactor, and stores the state of the registration in @p data.
+     */
+    std::error_code register_descriptor(int descriptor, per_descriptor_data& data);
+
+    /**
+     * Removes the registration of a descriptor, and cancels its pending
+     * operations, which complete with `std::errc::operation_canceled`. Must
+     * be called before the descriptor is closed.
+     */
+    void deregister_descriptor(per_descriptor_data& data);
+
+    /**
+     * Buffers are not registered with select: they're only of use to a
+     * completion-based backend (see uring_reactor).
+     */
+    std::error_code register_buffer(void*, std::size_t)
+    {
+        return std::make_error_code(std::errc::operation_not_supported);
+    }
+
+    /**
+     * Starts operation @p op of kind @p type on the descriptor of @p data,
+     * which either completes it right away, if nothing of its kind is queued
+     * and it doesn't block, or queues it until the descriptor is ready. The
+     * reactor owns the operation until it completes, and keeps the scheduler
+     * from running out of work while it's queued.
+     */
+    void start_op(op_type type, per_descriptor_data& data, reactor_op* op);
+
+    /**
+     * Cancels the pending operations of a descriptor, which complete with
+     * `std::errc::operation_canceled`.
+     */
+    void cancel_ops(per_descriptor_data& data);
+
+    /**
+     * Withdraws operation @p op of kind @p type from the descriptor of @p
+     * data, if it's still queued, and stops selecting the descriptor for that
+     * kind if it was the last one. May be called by any thread, as long as
+     * the operation hasn't been completed.
+     *
+     * @return True if the operation was withdrawn, in which case it has been
+     * aborted with `std::errc::operation_canceled`, and the caller completes
+     * it, then calls `work_finished` on the scheduler. Otherwise it completes
+     * as usual, or, if it hasn't been started yet, is aborted by @ref
+     * start_op.
+     */
+    bool cancel_op(op_type type, per_descriptor_data& data, reactor_op* op);
+
+    /**
+     * Aborts the pending operations of all registered descriptors with
+     * `std::errc::operation_canceled`, as the scheduler is destroyed.
+     */
+    void abort_all_ops();
+
+    /** Whether any operation is still pending, e.g. after @ref abort_all_ops. */
+    bool has_pending_ops();
 
     void interrupt()
     {
         interrupter_.interrupt();
     }
 
-    void run()
+    /**
+     * Makes @ref run return by @p expiry, or never if it's `time_point::max()`,
+     * without a timeout, if the reactor has a timerfd (see
+     * FREETURES_HAS_TIMERFD). Returns false otherwise, in which case the
+     * caller has to pass run a timeout. Only called by the thread running the
+     * reactor.
+     */
+    bool arm_timer(time_point expiry)
     {
-        // reinstate fd_set:
-        // 1) FD_ZERO(&fd_set)
-        // 2) FD_SET(fd, &fd_set) for each outstanding work
-        // 3) FD_SET(interrupter_.read_descriptor(), &fd_set)
-        // then block on the select call 
-        // int result = select(max_fd, fd_sets_[op::read], fd_sets_[op::write],
-        // fd_sets_[op::except], timeout)
-        // for each the descriptor that became available, execute the operation
-        // (i.e. read fd, write fd etc) and if finished, set its associated
-        // promise, then invoke scheduler_.post(promise)
+#if FREETURES_HAS_TIMERFD
+        timer_.arm(expiry);
+        return true;
+#else
+        (void)expiry;
+        return false;
+#endif
     }
 
+    /**
+     * @brief Waits for descriptor events and dispatches them.
+     *
+     * @param timeout The longest time to wait for an event, or until @ref
+     * interrupt is called. If zero, only checks for events that already
+     * occurred; if `duration::max()`, waits indefinitely.
+     */
+    void run(duration timeout);
+
     void stop()
     {
     }
+
+private:
+    // Adds a descriptor to or removes it from the master set of @p type, as
+    // its first operation of that kind is queued, or its last one dequeued.
+    // Expects mutex_ to be held.
+    void add_interest(int descriptor, int type) noexcept;
+    void remove_interest(int descriptor, int type) noexcept;
+
+    // Performs the queued operations of kind @p type of a ready descriptor
+    // until one would block, and collects those that are done in @p
+    // completed. Expects mutex_ to be held.
+    void perform_ops(descriptor_data& data, int type, op_queue<reactor_op>& completed);
+    void perform_writes(descriptor_data& data, op_queue<reactor_op>& completed);
+
+    // Dequeues all operations of a descriptor. Expects mutex_ to be held.
+    void abort_ops(descriptor_data& data, op_queue<reactor_op>& aborted) noexcept;
+
+    // Completes operations that left the queues, outside the lock.
+    void complete_ops(op_queue<reactor_op>& ops);
 };
 
 } // detail
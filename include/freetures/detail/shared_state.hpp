@@ -1,14 +1,21 @@
 #ifndef FREETURES_SHARED_STATE_HPP
 #define FREETURES_SHARED_STATE_HPP
 
-#include <utility>
-#include <functional>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
+#include <new>
+#include <system_error>
+#include <utility>
 
+#include "../error.hpp"
 #include "../promise.hpp"
+#include "op_queue.hpp"
+#include "ref_count.hpp"
 #include "scheduler.hpp"
 #include "optional.hpp"
 #include "type_traits.hpp"
+#include "unique_function.hpp"
 
 namespace ft {
 namespace detail {
@@ -16,13 +23,35 @@ namespace detail {
 using namespace tl;
 
 /**
- * This class handles the variation between a void future and a normal future
- * (void future's handler does not take an argument).
+ * How a future completed, as seen by its continuation: either with a value,
+ * which the continuation may move from, or with an error. A timeout is
+ * reported as the error `future_errc::timed_out`.
+ */
+template<typename T>
+class completion
+{
+    T* value_ = nullptr;
+    std::error_code error_;
+
+public:
+    explicit completion(T* value) noexcept : value_(value) {}
+    explicit completion(std::error_code error) noexcept : error_(error) {}
+
+    bool has_value() const noexcept { return value_ != nullptr; }
+    T& value() const noexcept { return *value_; }
+    std::error_code error() const noexcept { return error_; }
+};
+
+/**
+ * The handler that continues a future: it's invoked with the future's value,
+ * or with its error or timeout, so that it can pass either on to the futures
+ * that follow. (A cancelled future's continuation is dropped instead, see
+ * @ref shared_state::set_cancelled.)
  */
 template<typename T>
 class continuation
 {
-    std::function<void(T)> handler_;
+    unique_function<void(completion<T>)> handler_;
 
 public:
     continuation() = default;
@@ -32,9 +61,13 @@ public:
         : handler_(std::forward<Handler>(h))
     {}
 
-    template<typename U>
-    void operator()(U&& u) {
-        handler_(std::forward<U>(u));
+    void operator()(completion<T> c) {
+        handler_(c);
+    }
+
+    void reset() noexcept
+    {
+        handler_.reset();
     }
 };
 
@@ -59,101 +92,571 @@ public:
     //}
 //};
 
+/**
+ * The state shared by a promise and its future.
+ *
+ * The state counts its own references, held by its promise, its futures and,
+ * once fulfilled, by its scheduler's ready queue, in which the state itself is
+ * enqueued (which is why it is a @ref scheduler_op) until its handlers have
+ * been invoked. It is allocated from its scheduler's pool (see @ref create).
+ *
+ * A promise may be fulfilled by any thread, concurrently with its future's
+ * handlers being attached by another. The two sides meet in a single atomic
+ * word holding the status, which handlers have been attached and which of
+ * them have been invoked, and whether the handlers are scheduled to run. Each
+ * side first stores its part (the result, or a handler) and then publishes it
+ * with a compare-and-swap of the word; whichever side arrives second sees the
+ * other's part and schedules the handlers, so no lock is needed.
+ *
+ * Since a state is allocated for every future, it's kept small enough for the
+ * pool's 128 byte size class (for a `T` no larger than an error code, on a 64
+ * bit target). The status in the state word tells which of the value, the
+ * error or the forwarded-to state the storage holds, so they share it; and the
+ * error, timeout and cancellation handlers, which are rarer than
+ * continuations, are kept in a separate block that's only allocated once one
+ * of them is attached. The fields that completing the state touches come first,
+ * within the first cache line; the continuation, which is only touched once it
+ * runs, follows.
+ *
+ * The reference to the scheduler stays, although it's needed less often than
+ * the rest: a state can't find its pool from its own address, as slabs aren't
+ * aligned and large states come from the global heap, and dropping it alone
+ * wouldn't get the state into the 64 byte size class anyway.
+ */
 template<typename T>
-class shared_state
+class shared_state : public scheduler_op
 {
-    enum {
+    using word_type = std::uint16_t;
+
+    // The status, in the lowest bits of the state word.
+    enum status_type : word_type
+    {
         not_ready,
         ready,
         error,
         timed_out,
-    } status_ = not_ready;
+        cancelled,
+        // The handlers are passed on to another state (see forward_to).
+        forwarded,
+    };
+
+    enum : word_type
+    {
+        status_mask = 0x7,
+        // Set while the handlers are enqueued, or about to be invoked inline,
+        // by whoever set it.
+        scheduled = 1 << 3,
+        continuation_attached = 1 << 4,
+        error_handler_attached = 1 << 5,
+        timeout_handler_attached = 1 << 6,
+        cancel_handler_attached = 1 << 7,
+        attached_mask = 0xf0,
+        // The attached bits of the handlers that have been taken care of, i.e.
+        // invoked, dropped or forwarded, are repeated this many bits higher.
+        claimed_shift = 4,
+    };
+
+    // The handlers other than the continuation (see the class comment).
+    struct failure_handlers
+    {
+        unique_function<void(std::error_code)> on_error;
+        unique_function<void()> on_timeout;
+        unique_function<void()> on_cancel;
+    };
+
+    // Which member is engaged depends on the status: the value if the state
+    // is ready, the error if it failed, and the state that the handlers are
+    // passed on to if it's forwarded (see forward_to).
+    union storage
+    {
+        storage() noexcept {}
+        ~storage() {}
 
+        T value;
+        std::error_code error;
+        intrusive_ptr<shared_state> forwarded;
+    };
+
+    std::atomic<word_type> word_{not_ready};
+    ref_count refs_;
+    storage storage_;
     scheduler& scheduler_;
-    optional<T> result_;
-    optional<std::error_code> error_;
+    // Allocated from the scheduler's pool by the first failure handler to be
+    // attached.
+    std::atomic<failure_handlers*> failure_handlers_{nullptr};
+
+    continuation<T> continuation_;
 
-    optional<continuation<T>> continuation_;
-    //??? on_error_;
-    //??? on_timeout_;
+    explicit shared_state(scheduler& s)
+        : scheduler_op(&shared_state::do_complete)
+        , scheduler_(s)
+    {}
+
+    ~shared_state()
+    {
+        switch(status_of(word_.load(std::memory_order_relaxed))) {
+        case ready:
+            storage_.value.~T();
+            break;
+        case forwarded:
+            storage_.forwarded.~intrusive_ptr();
+            break;
+        default:
+            break;
+        }
+        if(failure_handlers* h = failure_handlers_.load(std::memory_order_relaxed)) {
+            destroy_failure_handlers(h);
+        }
+    }
 
 public:
-    explicit shared_state(scheduler& s) : scheduler_(s) {}
+    /**
+     * Allocates a state from the pool of @p s.
+     *
+     * @return The state, with a single reference owned by the caller.
+     */
+    static intrusive_ptr<shared_state> create(scheduler& s)
+    {
+        void* p = s.get_allocator().allocate(sizeof(shared_state));
+        return intrusive_ptr<shared_state>(::new(p) shared_state(s));
+    }
+
+    void add_ref() noexcept
+    {
+        refs_.increment();
+    }
+
+    void release() noexcept
+    {
+        if(refs_.decrement()) {
+            scheduler& s = scheduler_;
+            this->~shared_state();
+            s.get_allocator().deallocate(this, sizeof(shared_state));
+        }
+    }
 
     scheduler& get_scheduler()
     {
         return scheduler_;
     }
 
-    bool is_ready() const noexcept { return status_ == ready; }
+    bool is_ready() const noexcept { return status() == ready; }
+
+    /** Whether the promise has been neither fulfilled nor forwarded. */
+    bool is_pending() const noexcept { return status() == not_ready; }
 
     void set_value(T&& t)
     {
-        if(status_ != not_ready) {
-            // TODO
-            throw "ERROR";
-        }
-        result_ = optional<T>(std::move(t));
-        status_ = ready;
+        check_not_ready();
+        ::new(&storage_.value) T(std::move(t));
+        publish(ready);
     }
 
     void set_error(std::error_code error)
     {
-        if(status_ != not_ready) {
-            // TODO
-            throw "ERROR";
-        }
-        error_ = optional<T>(error);
-        status_ = error;
+        check_not_ready();
+        ::new(&storage_.error) std::error_code(error);
+        publish(shared_state::error);
     }
 
     void set_timeout()
     {
-        if(status_ != not_ready) {
-            // TODO
-            throw "ERROR";
+        check_not_ready();
+        publish(timed_out);
+    }
+
+    /**
+     * Passes on the failure of a preceding future, as reported to its
+     * continuation (see @ref completion).
+     */
+    void set_failure(std::error_code error)
+    {
+        if(error == future_errc::timed_out) {
+            set_timeout();
+        } else {
+            set_error(error);
+        }
+    }
+
+    /**
+     * Completes the state on the cancelled path: the cancellation handler is
+     * invoked instead of the continuation, which is dropped. Since dropping a
+     * continuation destroys the promise of the future it returned, without
+     * fulfilling it, the cancellation propagates down the chain.
+     */
+    void set_cancelled()
+    {
+        check_not_ready();
+        publish(cancelled);
+    }
+
+    /**
+     * Cancels the state if its promise is destroyed without having been
+     * fulfilled, and enqueues its handlers, if there are any yet.
+     */
+    void abandon()
+    {
+        if(publish(cancelled)) {
+            schedule();
         }
-        status_ = timed_out;
     }
 
     void attach_continuation(continuation<T>&& c)
     {
-        switch(status_) {
-        case not_ready:
-        case ready:
-            // register callback
-            break;
-        default:
-            throw "cannot overwrite existing continuation";
-            break;
+        attach(continuation_attached, [&] { continuation_ = std::move(c); },
+            [&](shared_state& inner) { inner.attach_continuation(std::move(c)); });
+    }
+
+    void attach_error_handler(unique_function<void(std::error_code)>&& h)
+    {
+        attach(error_handler_attached, [&] { get_failure_handlers().on_error = std::move(h); },
+            [&](shared_state& inner) { inner.attach_error_handler(std::move(h)); });
+    }
+
+    void attach_timeout_handler(unique_function<void()>&& h)
+    {
+        attach(timeout_handler_attached, [&] { get_failure_handlers().on_timeout = std::move(h); },
+            [&](shared_state& inner) { inner.attach_timeout_handler(std::move(h)); });
+    }
+
+    void attach_cancel_handler(unique_function<void()>&& h)
+    {
+        attach(cancel_handler_attached, [&] { get_failure_handlers().on_cancel = std::move(h); },
+            [&](shared_state& inner) { inner.attach_cancel_handler(std::move(h)); });
+    }
+
+    /**
+     * Drops the continuation, unless the promise has already been fulfilled
+     * (in which case the continuation is about to be invoked).
+     */
+    void detach_continuation() noexcept
+    {
+        word_type w = word_.load(std::memory_order_acquire);
+        do {
+            if(status_of(w) == forwarded) {
+                storage_.forwarded->detach_continuation();
+                return;
+            }
+            if(status_of(w) != not_ready
+                    || !(unclaimed_of(w) & continuation_attached)) {
+                return;
+            }
+        } while(!word_.compare_exchange_weak(w,
+                w | (continuation_attached << claimed_shift),
+                std::memory_order_acq_rel, std::memory_order_acquire));
+        continuation_.reset();
+    }
+
+    /**
+     * Makes @p inner deliver its result to this state's continuation, which is
+     * how the future returned by a handler is unwrapped: this state is never
+     * fulfilled itself, and once the inner future is ready, its scheduler
+     * invokes the continuation directly.
+     *
+     * Handlers that haven't been attached yet are attached to @p inner once
+     * they are.
+     */
+    void forward_to(intrusive_ptr<shared_state> inner)
+    {
+        assert(is_pending());
+        // Only read by those who see the forwarded status, which is published
+        // after this.
+        ::new(&storage_.forwarded) intrusive_ptr<shared_state>(std::move(inner));
+        word_type w = word_.load(std::memory_order_relaxed);
+        while(!word_.compare_exchange_weak(w, w | forwarded | claim_all(w),
+                std::memory_order_acq_rel, std::memory_order_acquire)) {}
+        const word_type handlers = unclaimed_of(w);
+        for(const word_type bit : { error_handler_attached, timeout_handler_attached,
+                cancel_handler_attached, continuation_attached }) {
+            if(handlers & bit) {
+                forward_handler(bit);
+            }
         }
     }
 
-    void move_handlers_to(shared_state& other)
+    /**
+     * Takes on the responsibility for running the handlers that are due, if
+     * there are any and nobody else has: the caller must then either enqueue
+     * the state or invoke its handlers (see @ref schedule and @ref
+     * scheduler::dispatch_ready_promise).
+     */
+    bool try_mark_scheduled() noexcept
     {
-        if(this == &other) {
-            return;
+        word_type w = word_.load(std::memory_order_acquire);
+        do {
+            if((w & scheduled) || !due_handlers(w)) {
+                return false;
+            }
+        } while(!word_.compare_exchange_weak(w, w | scheduled,
+                std::memory_order_acq_rel, std::memory_order_acquire));
+        return true;
+    }
+
+    /**
+     * @brief Enqueues this state in its scheduler's ready queue, if it has
+     * handlers to run that aren't already enqueued. May be called by any
+     * thread.
+     */
+    void schedule()
+    {
+        if(try_mark_scheduled()) {
+            // The queue's reference, which the scheduler hands to do_complete.
+            add_ref();
+            scheduler_.post_ready_op(this);
         }
     }
 
+    /**
+     * Invokes the handlers for how the state completed that are attached and
+     * haven't been invoked yet: the continuation with the value; the error or
+     * timeout handler, followed by the continuation, with the error or
+     * timeout; or only the cancellation handler.
+     */
     void invoke_handler()
     {
-        if(status_ == not_ready) {
-            throw "cannot invoke handler on not ready promise";
+        // Claim all the attached handlers. Handlers attached from now on find
+        // that they are not scheduled, and schedule themselves.
+        word_type w = word_.load(std::memory_order_acquire);
+        do {
+            if(status_of(w) == not_ready) {
+                throw_error(future_errc::not_ready,
+                        "cannot invoke handler on not ready promise");
+            }
+        } while(!word_.compare_exchange_weak(w, (w & ~scheduled) | claim_all(w),
+                std::memory_order_acq_rel, std::memory_order_acquire));
+        const word_type handlers = due_handlers(w);
+
+        if(scheduler_.is_shutting_down() && status_of(w) != cancelled) {
+            // Dropping the continuation cancels the futures that follow.
+            if(handlers & continuation_attached) {
+                continuation_.reset();
+            }
+            return;
         }
 
-        switch(status_) {
+        switch(status_of(w)) {
         case ready:
+            if(handlers & continuation_attached) {
+                invoke_continuation(completion<T>(&storage_.value));
+            }
             break;
         case error:
+            if(handlers & error_handler_attached) {
+                auto h = std::move(published_failure_handlers()->on_error);
+                h(storage_.error);
+            }
+            if(handlers & continuation_attached) {
+                invoke_continuation(completion<T>(storage_.error));
+            }
             break;
         case timed_out:
+            if(handlers & timeout_handler_attached) {
+                auto h = std::move(published_failure_handlers()->on_timeout);
+                h();
+            }
+            if(handlers & continuation_attached) {
+                invoke_continuation(completion<T>(make_error_code(future_errc::timed_out)));
+            }
+            break;
+        case cancelled:
+            if(handlers & continuation_attached) {
+                continuation_.reset();
+            }
+            if(handlers & cancel_handler_attached) {
+                auto h = std::move(published_failure_handlers()->on_cancel);
+                h();
+            }
             break;
-        default: assert(0);
+        default:
+            break;
+        }
+    }
+
+private:
+    static status_type status_of(word_type w) noexcept
+    {
+        return static_cast<status_type>(w & status_mask);
+    }
+
+    static word_type unclaimed_of(word_type w) noexcept
+    {
+        return w & attached_mask & ~(w >> claimed_shift);
+    }
+
+    static word_type claim_all(word_type w) noexcept
+    {
+        return (w & attached_mask) << claimed_shift;
+    }
+
+    /**
+     * The attached handlers that are yet to be invoked for the status in @p w.
+     * A completed state always has its continuation invoked (or, if it's
+     * cancelled, dropped), and the handler of its status, whose attached bit
+     * happens to be the status' value plus 3 bits up.
+     */
+    static word_type due_handlers(word_type w) noexcept
+    {
+        const word_type s = status_of(w);
+        if(s == not_ready || s == forwarded) {
+            return 0;
         }
+        const word_type status_handler = s == ready ? 0 : word_type(1) << (s + 3);
+        return unclaimed_of(w) & (continuation_attached | status_handler);
+    }
+
+    status_type status() const noexcept
+    {
+        return status_of(word_.load(std::memory_order_acquire));
+    }
+
+    void check_not_ready() const
+    {
+        if(status() != not_ready) {
+            throw_error(future_errc::promise_already_satisfied,
+                    "cannot fulfil a promise twice");
+        }
+    }
+
+    /**
+     * Publishes the completion of the state with @p s, which the promise's
+     * side has stored the result of.
+     *
+     * @return False if the state was no longer pending.
+     */
+    bool publish(status_type s) noexcept
+    {
+        word_type w = word_.load(std::memory_order_relaxed);
+        do {
+            if(status_of(w) != not_ready) {
+                return false;
+            }
+        } while(!word_.compare_exchange_weak(w, w | s,
+                std::memory_order_acq_rel, std::memory_order_relaxed));
+        return true;
+    }
+
+    /**
+     * Stores a handler with @p store and publishes it by setting its @p bit.
+     * If the state has already been forwarded, the handler is handed to the
+     * inner state with @p forward instead; if it's already completed, the
+     * handler is scheduled.
+     */
+    template<typename Store, typename Forward>
+    void attach(word_type bit, Store&& store, Forward&& forward)
+    {
+        const word_type w = word_.load(std::memory_order_acquire);
+        if(status_of(w) == forwarded) {
+            forward(*storage_.forwarded);
+            return;
+        }
+        if(w & bit) {
+            throw_error(future_errc::continuation_already_attached,
+                    "cannot overwrite existing handler");
+        }
+        store();
+        const word_type prev = word_.fetch_or(bit, std::memory_order_acq_rel);
+        if(status_of(prev) == forwarded) {
+            // The state was forwarded in the meantime, and the handler missed
+            // being passed on, so pass it on now.
+            forward_handler(bit);
+        } else if(status_of(prev) != not_ready) {
+            // The promise has already been fulfilled and its handlers may
+            // have been dispatched before this one existed, so make sure it
+            // runs.
+            schedule();
+        }
+    }
+
+    void forward_handler(word_type bit)
+    {
+        shared_state& inner = *storage_.forwarded;
+        switch(bit) {
+        case continuation_attached:
+            inner.attach_continuation(std::move(continuation_));
+            break;
+        case error_handler_attached:
+            inner.attach_error_handler(std::move(published_failure_handlers()->on_error));
+            break;
+        case timeout_handler_attached:
+            inner.attach_timeout_handler(std::move(published_failure_handlers()->on_timeout));
+            break;
+        case cancel_handler_attached:
+            inner.attach_cancel_handler(std::move(published_failure_handlers()->on_cancel));
+            break;
+        }
+    }
+
+    /** The block of failure handlers, once one of them has been published. */
+    failure_handlers* published_failure_handlers() noexcept
+    {
+        return failure_handlers_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * The block of failure handlers, which is allocated on first use. Once a
+     * state is forwarded, handlers may be attached to the inner state by two
+     * threads at once (see forward_to), so the block is installed atomically.
+     */
+    failure_handlers& get_failure_handlers()
+    {
+        failure_handlers* h = failure_handlers_.load(std::memory_order_acquire);
+        if(h) {
+            return *h;
+        }
+        void* p = scheduler_.get_allocator().allocate(sizeof(failure_handlers));
+        auto* created = ::new(p) failure_handlers();
+        if(!failure_handlers_.compare_exchange_strong(h, created,
+                std::memory_order_acq_rel, std::memory_order_acquire)) {
+            destroy_failure_handlers(created);
+            return *h;
+        }
+        return *created;
+    }
+
+    void destroy_failure_handlers(failure_handlers* h) noexcept
+    {
+        h->~failure_handlers();
+        scheduler_.get_allocator().deallocate(h, sizeof(failure_handlers));
+    }
+
+    void invoke_continuation(completion<T> result)
+    {
+        auto c = std::move(continuation_);
+        c(result);
+    }
+
+    static void do_complete(scheduler_op* op)
+    {
+        auto* state = static_cast<shared_state*>(op);
+        // Take over the queue's reference so that the state is released once
+        // its handlers return (unless someone else still holds it).
+        intrusive_ptr<shared_state> self(state);
+        state->invoke_handler();
     }
 };
 
+template<typename T>
+void scheduler::post_ready_promise(promise<T> p)
+{
+    p.state_->schedule();
+}
+
+template<typename T>
+void scheduler::dispatch_ready_promise(promise<T> p)
+{
+    thread_context& context = this_thread();
+    if(!can_execute_inline(context)) {
+        p.state_->schedule();
+        return;
+    }
+    // Without a handler there's nothing to execute yet: attaching one will
+    // enqueue the state.
+    if(p.state_->try_mark_scheduled()) {
+        inline_depth_guard guard(context);
+        p.state_->invoke_handler();
+    }
+}
+
 } // detail
 } // ft
 
@@ -0,0 +1,285 @@
+#ifndef FREETURES_SLAB_ALLOCATOR_HPP
+#define FREETURES_SLAB_ALLOCATOR_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+
+#include "config.hpp"
+#include "mpsc_queue.hpp"
+
+namespace ft {
+namespace detail {
+
+/**
+ * A pool of fixed-size blocks in a handful of size classes, from which a
+ * scheduler allocates the shared states of its promises.
+ *
+ * Blocks are carved out of slabs of @ref slab_size bytes. A freed block goes
+ * to the front of its size class's free list and is the first to be handed out
+ * again, so the memory a hot chain of futures touches stays in cache. Slabs are
+ * only released when the allocator is destroyed, so once the pools have grown
+ * to the program's peak demand, allocating never goes to the global heap
+ * again. Requests larger than the largest size class do go to the global heap.
+ *
+ * Blocks may be allocated and freed by any thread, unless threads are
+ * disabled (see FREETURES_HAS_THREADS), but the thread that owns the allocator
+ * (see @ref owner_guard), i.e. the thread running a scheduler that is run by a
+ * single thread, does so without any synchronization: it has a free list of
+ * its own. Other threads return blocks to a lock-free list, from which the
+ * owner takes them all at once when its own list runs dry, and allocate from
+ * a list guarded by a mutex.
+ */
+class slab_allocator
+{
+public:
+    static constexpr std::size_t num_size_classes = 4;
+    static constexpr std::size_t min_block_size = 64;
+    static constexpr std::size_t max_block_size = min_block_size << (num_size_classes - 1);
+    static constexpr std::size_t slab_size = 4096;
+
+    /** The occupancy of a size class. */
+    struct size_class_usage
+    {
+        std::size_t block_size;
+        // The number of blocks carved out of slabs so far.
+        std::size_t num_blocks;
+        std::size_t num_blocks_in_use;
+    };
+
+    using usage = std::array<size_class_usage, num_size_classes>;
+
+private:
+#if FREETURES_HAS_THREADS
+    using mutex_type = std::mutex;
+#else
+    struct mutex_type
+    {
+        void lock() noexcept {}
+        void unlock() noexcept {}
+    };
+#endif
+
+    struct free_block
+    {
+        free_block* next;
+    };
+
+    // Precedes the blocks in each slab, padded to keep the blocks aligned.
+    union slab_header
+    {
+        slab_header* next;
+        std::max_align_t align;
+    };
+
+    struct size_class
+    {
+        // Only used by the owner, which is the only one to write
+        // owner_balance (the number of blocks it allocated minus the number
+        // it freed), so it needs no read-modify-write.
+        free_block* owner_free_list = nullptr;
+        std::atomic<std::ptrdiff_t> owner_balance{0};
+
+        // Blocks freed by other threads, pushed with a CAS and taken all at
+        // once, by the owner or under the mutex.
+        alignas(cache_line_size) std::atomic<free_block*> remote_free_list{nullptr};
+        std::atomic<std::size_t> num_remote_frees{0};
+
+        mutex_type mutex;
+        free_block* free_list = nullptr;
+        slab_header* slabs = nullptr;
+        std::size_t num_blocks = 0;
+        // The number of blocks allocated by threads other than the owner.
+        std::size_t num_shared_allocations = 0;
+    };
+
+    size_class classes_[num_size_classes];
+
+public:
+    /**
+     * Makes the calling thread the owner of an allocator for as long as it
+     * exists. At most one thread may own an allocator at a time.
+     */
+    class owner_guard
+    {
+        const slab_allocator* prev_;
+
+    public:
+        explicit owner_guard(const slab_allocator& a) noexcept
+            : prev_(this_thread_owns())
+        {
+            this_thread_owns() = &a;
+        }
+
+        owner_guard(const owner_guard&) = delete;
+        owner_guard& operator=(const owner_guard&) = delete;
+
+        ~owner_guard()
+        {
+            this_thread_owns() = prev_;
+        }
+    };
+
+    slab_allocator() = default;
+    slab_allocator(const slab_allocator&) = delete;
+    slab_allocator& operator=(const slab_allocator&) = delete;
+
+    ~slab_allocator()
+    {
+        for(auto& c : classes_) {
+            while(c.slabs) {
+                slab_header* next = c.slabs->next;
+                ::operator delete(c.slabs);
+                c.slabs = next;
+            }
+        }
+    }
+
+    void* allocate(std::size_t size)
+    {
+        const std::size_t index = size_class_index(size);
+        if(index == num_size_classes) {
+            return ::operator new(size);
+        }
+
+        size_class& c = classes_[index];
+        if(this_thread_owns() == this) {
+            if(c.owner_free_list == nullptr) {
+                refill_owner_list(c, block_size(index));
+            }
+            free_block* block = c.owner_free_list;
+            c.owner_free_list = block->next;
+            c.owner_balance.store(c.owner_balance.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+            return block;
+        }
+
+        std::lock_guard<mutex_type> lock(c.mutex);
+        if(c.free_list == nullptr) {
+            c.free_list = c.remote_free_list.exchange(nullptr, std::memory_order_acquire);
+            if(c.free_list == nullptr) {
+                grow(c, block_size(index));
+            }
+        }
+        free_block* block = c.free_list;
+        c.free_list = block->next;
+        ++c.num_shared_allocations;
+        return block;
+    }
+
+    /** @p size must be the same as the one the block was allocated with. */
+    void deallocate(void* p, std::size_t size) noexcept
+    {
+        const std::size_t index = size_class_index(size);
+        if(index == num_size_classes) {
+            ::operator delete(p);
+            return;
+        }
+
+        size_class& c = classes_[index];
+        auto* block = static_cast<free_block*>(p);
+        if(this_thread_owns() == this) {
+            block->next = c.owner_free_list;
+            c.owner_free_list = block;
+            c.owner_balance.store(c.owner_balance.load(std::memory_order_relaxed) - 1,
+                    std::memory_order_relaxed);
+            return;
+        }
+
+        free_block* head = c.remote_free_list.load(std::memory_order_relaxed);
+        do {
+            block->next = head;
+        } while(!c.remote_free_list.compare_exchange_weak(head, block,
+                std::memory_order_release, std::memory_order_relaxed));
+        c.num_remote_frees.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * A snapshot of the occupancy of the size classes, which is only exact if
+     * no other thread is allocating or freeing blocks at the same time.
+     */
+    usage get_usage()
+    {
+        usage u;
+        for(std::size_t i = 0; i < num_size_classes; ++i) {
+            size_class& c = classes_[i];
+            std::lock_guard<mutex_type> lock(c.mutex);
+            u[i].block_size = block_size(i);
+            u[i].num_blocks = c.num_blocks;
+            u[i].num_blocks_in_use = static_cast<std::size_t>(
+                    c.owner_balance.load(std::memory_order_relaxed)
+                    + static_cast<std::ptrdiff_t>(c.num_shared_allocations)
+                    - static_cast<std::ptrdiff_t>(
+                        c.num_remote_frees.load(std::memory_order_relaxed)));
+        }
+        return u;
+    }
+
+private:
+    static constexpr std::size_t block_size(std::size_t index) noexcept
+    {
+        return min_block_size << index;
+    }
+
+    // Returns num_size_classes if size is too large for any size class.
+    static std::size_t size_class_index(std::size_t size) noexcept
+    {
+        std::size_t index = 0;
+        for(std::size_t s = min_block_size; s < size && index < num_size_classes; s <<= 1) {
+            ++index;
+        }
+        return index;
+    }
+
+    static const slab_allocator*& this_thread_owns() noexcept
+    {
+        static thread_local const slab_allocator* owned = nullptr;
+        return owned;
+    }
+
+    /**
+     * Gives the owner's empty free list the blocks freed by other threads, or
+     * failing that, those in the shared list, or failing that, a new slab.
+     */
+    static void refill_owner_list(size_class& c, std::size_t block_size)
+    {
+        if(c.remote_free_list.load(std::memory_order_relaxed) != nullptr) {
+            c.owner_free_list = c.remote_free_list.exchange(nullptr, std::memory_order_acquire);
+            if(c.owner_free_list) {
+                return;
+            }
+        }
+        std::lock_guard<mutex_type> lock(c.mutex);
+        if(c.free_list == nullptr) {
+            grow(c, block_size);
+        }
+        c.owner_free_list = c.free_list;
+        c.free_list = nullptr;
+    }
+
+    // Expects the size class's mutex to be held.
+    static void grow(size_class& c, std::size_t block_size)
+    {
+        const std::size_t n = (slab_size - sizeof(slab_header)) / block_size;
+        auto* slab = static_cast<slab_header*>(::operator new(
+                    sizeof(slab_header) + n * block_size));
+        slab->next = c.slabs;
+        c.slabs = slab;
+
+        // Thread the new blocks onto the free list in address order.
+        char* blocks = reinterpret_cast<char*>(slab + 1);
+        for(std::size_t i = n; i > 0; --i) {
+            auto* block = reinterpret_cast<free_block*>(blocks + (i - 1) * block_size);
+            block->next = c.free_list;
+            c.free_list = block;
+        }
+        c.num_blocks += n;
+    }
+};
+
+} // detail
+} // ft
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef FREETURES_SMALL_VECTOR_HPP
+#define FREETURES_SMALL_VECTOR_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace ft {
+namespace detail {
+
+/**
+ * A vector that stores up to @p N elements in place, and only moves them to an
+ * array on the heap once it grows beyond that.
+ *
+ * It supports just what its users need: appending, iterating and taking over
+ * the elements of another vector. Elements must be nothrow move constructible,
+ * as they are relocated when the vector grows.
+ */
+template<typename T, std::size_t N>
+class small_vector
+{
+    static_assert(N > 0, "small_vector needs room for at least one element");
+    static_assert(std::is_nothrow_move_constructible<T>::value,
+            "small_vector elements must be nothrow move constructible");
+    static_assert(alignof(T) <= alignof(std::max_align_t),
+            "over-aligned elements are not supported");
+
+    using storage_type = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+    storage_type inline_[N];
+    T* data_;
+    std::size_t size_ = 0;
+    std::size_t capacity_ = N;
+
+public:
+    small_vector() noexcept : data_(inline_data()) {}
+
+    /** Takes over the elements of @p other, which is left empty. */
+    small_vector(small_vector&& other) noexcept : data_(inline_data())
+    {
+        take(other);
+    }
+
+    small_vector& operator=(small_vector&& other) noexcept
+    {
+        if(this != &other) {
+            clear();
+            free_heap();
+            take(other);
+        }
+        return *this;
+    }
+
+    small_vector(const small_vector&) = delete;
+    small_vector& operator=(const small_vector&) = delete;
+
+    ~small_vector()
+    {
+        clear();
+        free_heap();
+    }
+
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+
+    T* begin() noexcept { return data_; }
+    T* end() noexcept { return data_ + size_; }
+
+    T& operator[](std::size_t i) noexcept
+    {
+        assert(i < size_);
+        return data_[i];
+    }
+
+    void push_back(T&& t)
+    {
+        if(size_ == capacity_) {
+            grow();
+        }
+        ::new(data_ + size_) T(std::move(t));
+        ++size_;
+    }
+
+    /** Destroys the elements, but keeps the capacity. */
+    void clear() noexcept
+    {
+        for(std::size_t i = 0; i < size_; ++i) {
+            data_[i].~T();
+        }
+        size_ = 0;
+    }
+
+private:
+    T* inline_data() noexcept
+    {
+        return reinterpret_cast<T*>(inline_);
+    }
+
+    bool is_inline() const noexcept
+    {
+        return capacity_ == N;
+    }
+
+    void grow()
+    {
+        const std::size_t capacity = 2 * capacity_;
+        auto* data = static_cast<T*>(::operator new(capacity * sizeof(T)));
+        relocate(data_, size_, data);
+        free_heap();
+        data_ = data;
+        capacity_ = capacity;
+    }
+
+    void free_heap() noexcept
+    {
+        if(!is_inline()) {
+            ::operator delete(data_);
+            data_ = inline_data();
+            capacity_ = N;
+        }
+    }
+
+    // Expects this vector to be empty and inline.
+    void take(small_vector& other) noexcept
+    {
+        if(other.is_inline()) {
+            relocate(other.data_, other.size_, data_);
+        } else {
+            data_ = other.data_;
+            capacity_ = other.capacity_;
+            other.data_ = other.inline_data();
+            other.capacity_ = N;
+        }
+        size_ = other.size_;
+        other.size_ = 0;
+    }
+
+    static void relocate(T* from, std::size_t n, T* to) noexcept
+    {
+        for(std::size_t i = 0; i < n; ++i) {
+            ::new(to + i) T(std::move(from[i]));
+            from[i].~T();
+        }
+    }
+};
+
+} // detail
+} // ft
+
+#endif
@@ -0,0 +1,267 @@
+#ifndef FREETURES_TIMER_IMPL_HPP
+#define FREETURES_TIMER_IMPL_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+#include "../time.hpp"
+#include "scheduler.hpp"
+#include "timer_wheel.hpp"
+#include "type_traits.hpp"
+#include "unique_function.hpp"
+
+namespace ft {
+namespace detail {
+
+/**
+ * @brief A long-lived timer that may be armed any number of times.
+ *
+ * The timer owns a single timer operation, allocated along with it, which is
+ * reused for every wait, so arming the timer merely links the operation into
+ * the scheduler's timer wheel. Once a handler has been set, neither re-arming
+ * the timer with it (see @ref async_wait()) nor the rearming of a repeating
+ * timer allocates.
+ *
+ * Like the scheduler, a timer is not thread-safe: it must not be used by
+ * multiple threads at the same time (its handler counts as a use).
+ */
+class timer
+{
+    using handler_type = unique_function<void(std::size_t)>;
+
+    // Once the operation has expired, or has been handed to the scheduler by
+    // another thread, it can no longer be withdrawn from the scheduler's
+    // queues. If the timer is destroyed in the meantime, it leaves the
+    // operation behind, which frees itself once it's delivered.
+    class expiry_op final : public timer_op
+    {
+    public:
+        // Null once the timer is gone.
+        timer* owner;
+
+        explicit expiry_op(timer* t)
+            : timer_op(&timer::do_complete)
+            , owner(t)
+        {}
+    };
+
+    scheduler& scheduler_;
+    expiry_op* op_;
+    handler_type handler_;
+    time_point expiry_;
+    // Zero if the timer is not repeating.
+    duration period_ = duration::zero();
+    catch_up policy_ = catch_up::fire_all;
+
+    // Whether the timer operation has been handed to the scheduler and has not
+    // completed yet. While it is, it can't be handed over again.
+    bool pending_ = false;
+    // Set if the timer was cancelled or re-armed while its expiry could no
+    // longer be withdrawn from the scheduler, which is then dropped or turned
+    // into arming the timer, respectively.
+    bool cancelled_ = false;
+    bool rearm_ = false;
+
+    // Set while the handler is invoked, so that we learn if it destroyed us.
+    bool* destroyed_ = nullptr;
+
+public:
+    explicit timer(scheduler& s)
+        : scheduler_(s)
+        , op_(new expiry_op(this))
+        , expiry_(clock::now())
+    {}
+
+    timer(const timer&) = delete;
+    timer& operator=(const timer&) = delete;
+
+    ~timer()
+    {
+        cancel();
+        if(pending_) {
+            op_->owner = nullptr;
+        } else {
+            delete op_;
+        }
+        if(destroyed_) {
+            *destroyed_ = true;
+        }
+    }
+
+    time_point expiry() const noexcept
+    {
+        return expiry_;
+    }
+
+    /**
+     * Sets the point in time at which the next wait completes. Doesn't affect
+     * a wait that is already in progress.
+     */
+    void expires_at(time_point t) noexcept
+    {
+        expiry_ = t;
+    }
+
+    void expires_after(duration d) noexcept
+    {
+        expiry_ = clock::now() + d;
+    }
+
+    /**
+     * Invokes @p handler once the expiry time has been reached. A wait already
+     * in progress is cancelled, i.e. its handler is not invoked.
+     *
+     * @p handler may re-arm, cancel or destroy the timer.
+     */
+    template<typename F>
+    void async_wait(F&& handler)
+    {
+        cancel();
+        handler_ = wrap(std::forward<F>(handler));
+        arm();
+    }
+
+    /** Waits again, invoking the handler of the previous wait or repetition. */
+    void async_wait()
+    {
+        cancel();
+        arm();
+    }
+
+    /**
+     * Invokes @p handler every @p period, the first time @p period after now.
+     *
+     * Deadlines are kept on a fixed grid relative to the first one, so late
+     * invocations don't accumulate drift. Deadlines that are missed because
+     * the scheduler was busy or the handler overran its period are handled
+     * according to @p policy; with @ref catch_up::coalesce the handler is
+     * passed the number of deadlines that were merged into the invocation (it
+     * may also take no arguments).
+     *
+     * @p handler may re-arm, cancel or destroy the timer.
+     */
+    template<typename F>
+    void repeat(F&& handler, duration period, catch_up policy = catch_up::fire_all)
+    {
+        assert(period > duration::zero());
+        cancel();
+        handler_ = wrap(std::forward<F>(handler));
+        period_ = period;
+        policy_ = policy;
+        expiry_ = clock::now() + period;
+        arm();
+    }
+
+    /**
+     * Cancels the wait or repetition in progress, without invoking the
+     * handler.
+     *
+     * @return False if there was nothing to cancel.
+     */
+    bool cancel()
+    {
+        period_ = duration::zero();
+        rearm_ = false;
+        if(!pending_ || cancelled_) {
+            return false;
+        }
+        if(scheduler_.cancel_timer(*op_)) {
+            pending_ = false;
+        } else {
+            cancelled_ = true;
+        }
+        return true;
+    }
+
+private:
+    template<typename F>
+    static handler_type wrap(F&& handler, typename std::enable_if<
+            is_callable<typename std::decay<F>::type(std::size_t)>::value>::type* = 0)
+    {
+        return handler_type(std::forward<F>(handler));
+    }
+
+    template<typename F>
+    static handler_type wrap(F&& handler, typename std::enable_if<
+            !is_callable<typename std::decay<F>::type(std::size_t)>::value>::type* = 0)
+    {
+        return [h = std::forward<F>(handler)](std::size_t) mutable { h(); };
+    }
+
+    void arm()
+    {
+        if(pending_) {
+            // The previous expiry is already on its way, arm again once it
+            // arrives.
+            cancelled_ = false;
+            rearm_ = true;
+            return;
+        }
+        pending_ = true;
+        scheduler_.start_timer(*op_, expiry_);
+    }
+
+    static void do_complete(scheduler_op* base)
+    {
+        auto* op = static_cast<expiry_op*>(base);
+        if(op->owner == nullptr) {
+            delete op;
+            return;
+        }
+        timer& t = *op->owner;
+        t.pending_ = false;
+        if(t.scheduler_.is_shutting_down()) {
+            // The scheduler is being destroyed, which cancels the timer.
+            t.period_ = duration::zero();
+            t.rearm_ = false;
+            t.cancelled_ = false;
+            return;
+        }
+        if(t.rearm_) {
+            t.rearm_ = false;
+            t.arm();
+            return;
+        }
+        if(t.cancelled_) {
+            t.cancelled_ = false;
+            return;
+        }
+
+        std::size_t missed = 0;
+        if(t.period_ != duration::zero() && t.policy_ != catch_up::fire_all) {
+            // Fold the deadlines that have passed since this one into this
+            // invocation.
+            const auto late = clock::now() - t.expiry_;
+            if(late >= t.period_) {
+                missed = static_cast<std::size_t>(late / t.period_);
+                t.expiry_ += t.period_ * static_cast<duration::rep>(missed);
+            }
+        }
+
+        // The handler may give the timer a new handler, so it must not be
+        // invoked in place.
+        bool destroyed = false;
+        t.destroyed_ = &destroyed;
+        handler_type handler = std::move(t.handler_);
+        handler(t.policy_ == catch_up::coalesce ? missed : 0);
+        if(destroyed) {
+            return;
+        }
+        t.destroyed_ = nullptr;
+        if(!t.handler_) {
+            t.handler_ = std::move(handler);
+        }
+        // Unless the handler cancelled or re-armed the timer.
+        if(t.period_ != duration::zero() && !t.pending_) {
+            t.expiry_ += t.period_;
+            t.arm();
+        }
+    }
+};
+
+} // detail
+} // ft
+
+#endif
@@ -0,0 +1,335 @@
+#ifndef FREETURES_TIMER_WHEEL_HPP
+#define FREETURES_TIMER_WHEEL_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include "../time.hpp"
+#include "op_queue.hpp"
+
+namespace ft {
+namespace detail {
+
+class timer_wheel;
+
+/**
+ * The base of operations that are executed once a point in time has been
+ * reached. When its timer expires, the operation is posted to the scheduler's
+ * ready queue like any other operation.
+ */
+class timer_op : public scheduler_op
+{
+    friend class timer_wheel;
+
+    // Links within the wheel slot the timer is in.
+    timer_op* prev_ = nullptr;
+    timer_op* next_in_slot_ = nullptr;
+    std::uint64_t when_ = 0;
+    std::uint8_t level_ = 0;
+    std::uint8_t slot_ = 0;
+    bool in_wheel_ = false;
+
+protected:
+    explicit timer_op(func_type f) noexcept : scheduler_op(f) {}
+    ~timer_op() = default;
+
+public:
+    /** Whether the timer is waiting in a wheel, i.e. it can be cancelled. */
+    bool is_pending() const noexcept { return in_wheel_; }
+
+    /** The tick at which the timer expires. */
+    std::uint64_t expiry() const noexcept { return when_; }
+
+    /** Sets the tick at which the timer expires, before it's inserted. */
+    void set_expiry(std::uint64_t when) noexcept
+    {
+        assert(!in_wheel_);
+        when_ = when;
+    }
+};
+
+/**
+ * A hierarchical timing wheel.
+ *
+ * Time is divided into ticks of @ref resolution. The wheel has @ref
+ * num_levels levels of 64 slots each, where a slot on level N spans 64^N
+ * ticks, so the whole wheel covers 64^6 ticks (about 795 days at 1ms). Timers
+ * are kept in an intrusive doubly-linked list per slot, so inserting and
+ * cancelling are O(1). Each level has a bitmap of its non-empty slots, so
+ * finding the next slot due is a handful of bit operations regardless of the
+ * number of timers.
+ *
+ * As time advances, the timers in a due slot of a higher level are
+ * redistributed to lower levels, until they reach level 0, where they expire.
+ * All timers due by the time the wheel is advanced are expired in one batch.
+ *
+ * Like the scheduler, the wheel itself is not thread-safe.
+ */
+class timer_wheel
+{
+public:
+    using tick_type = std::uint64_t;
+
+    static constexpr int num_levels = 6;
+    static constexpr int slot_bits = 6;
+    static constexpr int num_slots = 1 << slot_bits;
+    static constexpr tick_type max_ticks = tick_type(1) << (num_levels * slot_bits);
+
+    /** The duration of a single tick. */
+    static constexpr milliseconds resolution() noexcept { return milliseconds(1); }
+
+private:
+    struct wheel_level
+    {
+        std::uint64_t occupied = 0;
+        timer_op* slots[num_slots] = {};
+    };
+
+    const time_point start_;
+    // The tick up to which the wheel has been advanced.
+    tick_type elapsed_ = 0;
+    std::size_t size_ = 0;
+    wheel_level levels_[num_levels];
+
+public:
+    explicit timer_wheel(time_point start = clock::now()) : start_(start) {}
+
+    timer_wheel(const timer_wheel&) = delete;
+    timer_wheel& operator=(const timer_wheel&) = delete;
+
+    bool empty() const noexcept { return size_ == 0; }
+    std::size_t size() const noexcept { return size_; }
+    tick_type elapsed() const noexcept { return elapsed_; }
+
+    /**
+     * Converts @p t to the first tick that is not before it, so that timers
+     * never expire early. This doesn't access any mutable state of the wheel,
+     * so it may be called from any thread.
+     */
+    tick_type expiry_tick(time_point t) const noexcept
+    {
+        if(t <= start_) {
+            return 0;
+        }
+        const auto ticks = (t - start_ + resolution() - duration(1)) / resolution();
+        return static_cast<tick_type>(ticks);
+    }
+
+    /** Converts @p t to the last tick that is not after it. */
+    tick_type current_tick(time_point t) const noexcept
+    {
+        if(t <= start_) {
+            return 0;
+        }
+        return static_cast<tick_type>((t - start_) / resolution());
+    }
+
+    time_point to_time_point(tick_type tick) const noexcept
+    {
+        return start_ + duration_cast<duration>(resolution() * tick);
+    }
+
+    /**
+     * Inserts @p t to expire at the tick set by @ref timer_op::set_expiry.
+     *
+     * @return False if that tick has already elapsed, in which case @p t is not
+     * inserted and should be expired right away.
+     */
+    bool insert(timer_op& t) noexcept
+    {
+        assert(!t.in_wheel_);
+        if(t.when_ <= elapsed_) {
+            return false;
+        }
+        if(t.when_ - elapsed_ >= max_ticks) {
+            t.when_ = elapsed_ + max_ticks - 1;
+        }
+        link(t);
+        ++size_;
+        return true;
+    }
+
+    /**
+     * Removes @p t from the wheel.
+     *
+     * @return False if @p t was not in the wheel (e.g. it already expired).
+     */
+    bool remove(timer_op& t) noexcept
+    {
+        if(!t.in_wheel_) {
+            return false;
+        }
+        unlink(t);
+        --size_;
+        return true;
+    }
+
+    /**
+     * Removes all timers from the wheel, appending them to @p removed.
+     *
+     * @return The number of removed timers.
+     */
+    std::size_t remove_all(op_queue<scheduler_op>& removed) noexcept
+    {
+        std::size_t num_removed = 0;
+        for(auto& level : levels_) {
+            for(timer_op*& head : level.slots) {
+                while(timer_op* t = head) {
+                    head = t->next_in_slot_;
+                    t->prev_ = t->next_in_slot_ = nullptr;
+                    t->in_wheel_ = false;
+                    removed.push(t);
+                    ++num_removed;
+                }
+            }
+            level.occupied = 0;
+        }
+        size_ -= num_removed;
+        return num_removed;
+    }
+
+    /**
+     * @return The tick at which the earliest non-empty slot is due, or
+     * `max_ticks` if the wheel is empty. Timers in the slots of higher levels
+     * may expire later, this is only a lower bound.
+     */
+    tick_type next_expiration() const noexcept
+    {
+        int level;
+        int slot;
+        tick_type deadline;
+        if(next_slot(level, slot, deadline)) {
+            return deadline;
+        }
+        return max_ticks;
+    }
+
+    /**
+     * Advances the wheel to tick @p now, appending all timers that expire by
+     * then to @p expired.
+     *
+     * @return The number of expired timers.
+     */
+    std::size_t advance(tick_type now, op_queue<scheduler_op>& expired) noexcept
+    {
+        std::size_t num_expired = 0;
+        int level;
+        int slot;
+        tick_type deadline;
+        while(next_slot(level, slot, deadline) && deadline <= now) {
+            elapsed_ = deadline;
+
+            // Detach the whole slot, then either expire its timers or move
+            // them down to a finer level.
+            timer_op* t = levels_[level].slots[slot];
+            levels_[level].slots[slot] = nullptr;
+            levels_[level].occupied &= ~(std::uint64_t(1) << slot);
+            while(t) {
+                timer_op* next = t->next_in_slot_;
+                t->prev_ = t->next_in_slot_ = nullptr;
+                t->in_wheel_ = false;
+                if(t->when_ <= now) {
+                    expired.push(t);
+                    --size_;
+                    ++num_expired;
+                } else {
+                    link(*t);
+                }
+                t = next;
+            }
+        }
+        if(now > elapsed_) {
+            elapsed_ = now;
+        }
+        return num_expired;
+    }
+
+private:
+    static int level_for(tick_type elapsed, tick_type when) noexcept
+    {
+        // The level is determined by the most significant bit in which the
+        // expiry differs from the current time.
+        const tick_type masked = (elapsed ^ when) | (num_slots - 1);
+        const int significant = 63 - __builtin_clzll(masked);
+        const int level = significant / slot_bits;
+        return level < num_levels ? level : num_levels - 1;
+    }
+
+    void link(timer_op& t) noexcept
+    {
+        const int level = level_for(elapsed_, t.when_);
+        const int slot = (t.when_ >> (level * slot_bits)) & (num_slots - 1);
+        t.level_ = static_cast<std::uint8_t>(level);
+        t.slot_ = static_cast<std::uint8_t>(slot);
+        t.in_wheel_ = true;
+
+        timer_op*& head = levels_[level].slots[slot];
+        t.prev_ = nullptr;
+        t.next_in_slot_ = head;
+        if(head) {
+            head->prev_ = &t;
+        }
+        head = &t;
+        levels_[level].occupied |= std::uint64_t(1) << slot;
+    }
+
+    void unlink(timer_op& t) noexcept
+    {
+        wheel_level& l = levels_[t.level_];
+        if(t.prev_) {
+            t.prev_->next_in_slot_ = t.next_in_slot_;
+        } else {
+            l.slots[t.slot_] = t.next_in_slot_;
+            if(t.next_in_slot_ == nullptr) {
+                l.occupied &= ~(std::uint64_t(1) << t.slot_);
+            }
+        }
+        if(t.next_in_slot_) {
+            t.next_in_slot_->prev_ = t.prev_;
+        }
+        t.prev_ = t.next_in_slot_ = nullptr;
+        t.in_wheel_ = false;
+    }
+
+    /**
+     * Finds the next non-empty slot. Slots of lower levels are always due
+     * before those of higher levels, so the first level with a non-empty slot
+     * has the earliest one.
+     */
+    bool next_slot(int& level, int& slot, tick_type& deadline) const noexcept
+    {
+        for(int l = 0; l < num_levels; ++l) {
+            const std::uint64_t occupied = levels_[l].occupied;
+            if(occupied == 0) {
+                continue;
+            }
+            const int shift = l * slot_bits;
+            const tick_type slot_range = tick_type(1) << shift;
+            const tick_type level_range = slot_range << slot_bits;
+            const int now_slot = (elapsed_ >> shift) & (num_slots - 1);
+            // Rotate so that the current slot is bit 0, then the next occupied
+            // slot is the lowest set bit.
+            const std::uint64_t rotated = now_slot == 0 ? occupied
+                : (occupied >> now_slot) | (occupied << (num_slots - now_slot));
+            const int s = (__builtin_ctzll(rotated) + now_slot) & (num_slots - 1);
+
+            const tick_type level_start = elapsed_ & ~(level_range - 1);
+            tick_type d = level_start + s * slot_range;
+            if(d <= elapsed_) {
+                // The slot has wrapped around.
+                d += level_range;
+            }
+            level = l;
+            slot = s;
+            deadline = d;
+            return true;
+        }
+        return false;
+    }
+};
+
+} // detail
+} // ft
+
+#endif
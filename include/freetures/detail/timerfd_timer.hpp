@@ -0,0 +1,109 @@
+#ifndef FREETURES_TIMERFD_TIMER_HPP
+#define FREETURES_TIMERFD_TIMER_HPP
+
+#include "config.hpp"
+
+#if FREETURES_HAS_TIMERFD
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <system_error>
+#include <type_traits>
+
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../error.hpp"
+#include "../time.hpp"
+
+namespace ft {
+namespace detail {
+
+/**
+ * A timerfd that becomes readable at the deadline it's armed with, which lets
+ * a reactor wait for descriptors and for the scheduler's next timer in the
+ * same indefinite wait.
+ *
+ * The timer remembers its deadline, so arming it with the one it already has
+ * (which is what happens on most waits) costs no system call.
+ */
+class timerfd_timer
+{
+    static_assert(std::is_same<clock, std::chrono::steady_clock>::value
+            || std::is_same<clock, std::chrono::system_clock>::value,
+            "the timerfd must run on the scheduler's clock");
+
+    // The clock that ft::clock reads, and with which the deadlines compare.
+    static constexpr clockid_t clock_id
+        = std::is_same<clock, std::chrono::steady_clock>::value
+        ? CLOCK_MONOTONIC : CLOCK_REALTIME;
+
+    int descriptor_ = -1;
+    // The armed deadline, or time_point::max() if the timer is disarmed or
+    // has expired.
+    time_point expiry_ = time_point::max();
+
+public:
+    timerfd_timer()
+        : descriptor_(::timerfd_create(clock_id, TFD_NONBLOCK | TFD_CLOEXEC))
+    {
+        if(descriptor_ == -1) {
+            throw_error(std::error_code(errno, std::system_category()),
+                    "timerfd_timer");
+        }
+    }
+
+    timerfd_timer(const timerfd_timer&) = delete;
+    timerfd_timer& operator=(const timerfd_timer&) = delete;
+
+    ~timerfd_timer()
+    {
+        ::close(descriptor_);
+    }
+
+    /**
+     * Makes the descriptor readable at @p expiry, instead of at the deadline
+     * it was armed with before, or never if @p expiry is `time_point::max()`.
+     * A deadline that has passed makes it readable right away.
+     */
+    void arm(time_point expiry)
+    {
+        if(expiry == expiry_) {
+            return;
+        }
+        itimerspec spec = {};
+        if(expiry != time_point::max()) {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    expiry.time_since_epoch()).count();
+            // A zero value would disarm the timer.
+            if(ns <= 0) {
+                ns = 1;
+            }
+            spec.it_value.tv_sec = static_cast<time_t>(ns / 1000000000);
+            spec.it_value.tv_nsec = static_cast<long>(ns % 1000000000);
+        }
+        if(::timerfd_settime(descriptor_, TFD_TIMER_ABSTIME, &spec, nullptr) == 0) {
+            expiry_ = expiry;
+        }
+    }
+
+    /** Consumes the expiry, so that the descriptor is no longer readable. */
+    void reset()
+    {
+        std::uint64_t count;
+        const auto result = ::read(descriptor_, &count, sizeof(count));
+        (void)result;
+        expiry_ = time_point::max();
+    }
+
+    int descriptor() { return descriptor_; }
+};
+
+} // detail
+} // ft
+
+#endif // FREETURES_HAS_TIMERFD
+
+#endif
@@ -72,6 +72,18 @@ struct is_callable_impl<F(Args...), 4,
 template <typename Expr>
 struct is_callable_impl<Expr, 5> : std::false_type {};
 
+//------------------------------------------------------------------------------
+/**
+ * Yields `T`, but only once `Dependent` is known. Used to defer the
+ * instantiation of types that are not yet complete where a template is
+ * defined (e.g. `promise` within the scheduler).
+ */
+template<class T, class Dependent>
+struct dependent_type
+{
+    using type = T;
+};
+
 //------------------------------------------------------------------------------
 /**
  * Specialization for T types that are not futures. Acts as an identity
@@ -90,6 +102,22 @@ struct inner_result_type<future<T>>
     using type = T;
 };
 
+/**
+ * Since `future<void>` is not supported, operations that produce no value
+ * result in a `future<null_tag>`.
+ */
+template<class T>
+struct non_void
+{
+    using type = T;
+};
+
+template<>
+struct non_void<void>
+{
+    using type = null_tag;
+};
+
 } // detail
 
 //------------------------------------------------------------------------------
@@ -130,6 +158,15 @@ struct callable_traits
     constexpr static const bool returns_future = is_future<result_type>::value;
 };
 
+/** Specialization for callables that take no argument. */
+template<class F>
+struct callable_traits<F, void>
+{
+    using result_type = typename std::result_of<F()>::type;
+    using inner_result_type = typename detail::inner_result_type<result_type>::type;
+    constexpr static const bool returns_future = is_future<result_type>::value;
+};
+
 //template<class F>
 //struct callable_traits<F, null_tag>
 //{
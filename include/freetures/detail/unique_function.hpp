@@ -0,0 +1,205 @@
+#ifndef FREETURES_UNIQUE_FUNCTION_HPP
+#define FREETURES_UNIQUE_FUNCTION_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "type_traits.hpp"
+
+/**
+ * The number of bytes a @ref ft::detail::unique_function can store a callable
+ * in before it has to allocate it. The default fits a promise and a handful of
+ * references or pointers, which is what most continuations capture.
+ */
+#ifndef FREETURES_FUNCTION_INLINE_SIZE
+# define FREETURES_FUNCTION_INLINE_SIZE 48
+#endif
+
+namespace ft {
+namespace detail {
+
+template<typename Signature, std::size_t InlineSize = FREETURES_FUNCTION_INLINE_SIZE>
+class unique_function;
+
+/**
+ * A move-only, type-erased callable, used for continuations and posted
+ * functions instead of `std::function`.
+ *
+ * Callables that fit into @p InlineSize bytes (and can be moved without
+ * throwing) are stored in place, so wrapping a typical handler doesn't
+ * allocate. Since the wrapper is never copied, neither must the callable be,
+ * so handlers may capture move-only objects such as promises.
+ *
+ * The operations of each callable type are a table of plain function pointers
+ * rather than virtual functions, and invoking the callable goes through a
+ * single one of them.
+ */
+template<typename R, typename... Args, std::size_t InlineSize>
+class unique_function<R(Args...), InlineSize>
+{
+    struct vtable
+    {
+        R (*invoke)(void*, Args&&...);
+        // Move-constructs the callable in the second storage from the first,
+        // and destroys the first.
+        void (*relocate)(void*, void*) noexcept;
+        void (*destroy)(void*) noexcept;
+    };
+
+    using storage_type = typename std::aligned_storage<
+        InlineSize, alignof(std::max_align_t)>::type;
+
+    template<typename F>
+    struct is_inline : std::integral_constant<bool,
+        sizeof(F) <= sizeof(storage_type)
+        && alignof(storage_type) % alignof(F) == 0
+        && std::is_nothrow_move_constructible<F>::value>
+    {};
+
+    // Operations of callables stored in place.
+    template<typename F>
+    struct inline_ops
+    {
+        static R invoke(void* s, Args&&... args)
+        {
+            return (*static_cast<F*>(s))(std::forward<Args>(args)...);
+        }
+
+        static void relocate(void* from, void* to) noexcept
+        {
+            ::new(to) F(std::move(*static_cast<F*>(from)));
+            static_cast<F*>(from)->~F();
+        }
+
+        static void destroy(void* s) noexcept
+        {
+            static_cast<F*>(s)->~F();
+        }
+
+        static const vtable* get() noexcept
+        {
+            static const vtable table = { &invoke, &relocate, &destroy };
+            return &table;
+        }
+    };
+
+    // Operations of callables too large to be stored in place, for which the
+    // storage holds a pointer.
+    template<typename F>
+    struct heap_ops
+    {
+        static F*& ptr(void* s) noexcept
+        {
+            return *static_cast<F**>(s);
+        }
+
+        static R invoke(void* s, Args&&... args)
+        {
+            return (*ptr(s))(std::forward<Args>(args)...);
+        }
+
+        static void relocate(void* from, void* to) noexcept
+        {
+            ::new(to) F*(ptr(from));
+        }
+
+        static void destroy(void* s) noexcept
+        {
+            delete ptr(s);
+        }
+
+        static const vtable* get() noexcept
+        {
+            static const vtable table = { &invoke, &relocate, &destroy };
+            return &table;
+        }
+    };
+
+    storage_type storage_;
+    const vtable* vtable_ = nullptr;
+
+public:
+    unique_function() = default;
+
+    template<
+        typename F,
+        typename D = typename std::decay<F>::type,
+        typename = typename std::enable_if<
+            !std::is_same<D, unique_function>::value
+            && is_callable<D&(Args...)>::value>::type
+    > unique_function(F&& f)
+    {
+        emplace<D>(std::forward<F>(f), is_inline<D>());
+    }
+
+    unique_function(unique_function&& other) noexcept
+        : vtable_(other.vtable_)
+    {
+        if(vtable_) {
+            vtable_->relocate(&other.storage_, &storage_);
+            other.vtable_ = nullptr;
+        }
+    }
+
+    unique_function& operator=(unique_function&& other) noexcept
+    {
+        if(this != &other) {
+            reset();
+            if(other.vtable_) {
+                other.vtable_->relocate(&other.storage_, &storage_);
+                vtable_ = other.vtable_;
+                other.vtable_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    unique_function(const unique_function&) = delete;
+    unique_function& operator=(const unique_function&) = delete;
+
+    ~unique_function()
+    {
+        reset();
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return vtable_ != nullptr;
+    }
+
+    /** Destroys the stored callable, if any. */
+    void reset() noexcept
+    {
+        if(vtable_) {
+            vtable_->destroy(&storage_);
+            vtable_ = nullptr;
+        }
+    }
+
+    R operator()(Args... args)
+    {
+        return vtable_->invoke(&storage_, std::forward<Args>(args)...);
+    }
+
+private:
+    template<typename D, typename F>
+    void emplace(F&& f, std::true_type /*is_inline*/)
+    {
+        ::new(&storage_) D(std::forward<F>(f));
+        vtable_ = inline_ops<D>::get();
+    }
+
+    template<typename D, typename F>
+    void emplace(F&& f, std::false_type /*is_inline*/)
+    {
+        ::new(&storage_) D*(new D(std::forward<F>(f)));
+        vtable_ = heap_ops<D>::get();
+    }
+};
+
+} // detail
+} // ft
+
+#endif
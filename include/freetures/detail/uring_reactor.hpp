@@ -0,0 +1,320 @@
+#ifndef FREETURES_URING_REACTOR_HPP
+#define FREETURES_URING_REACTOR_HPP
+
+#include "config.hpp"
+
+#if FREETURES_HAS_IO_URING
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <vector>
+
+#include <linux/io_uring.h>
+
+#include "../time.hpp"
+#include "epoll_reactor.hpp"
+#include "op_queue.hpp"
+#include "reactor_op.hpp"
+#include "interrupter.hpp"
+
+#ifndef IORING_ASYNC_CANCEL_FD
+# error "io_uring headers of Linux 5.19 or later are needed; define FREETURES_HAS_IO_URING=0"
+#endif
+
+namespace ft {
+namespace detail {
+
+class scheduler;
+
+/**
+ * A reactor that hands operations to the kernel through io_uring, driven by
+ * raw system calls.
+ *
+ * Operations that transfer a single buffer (see @ref reactor_op::buffer_) are
+ * submitted as reads and writes, which the kernel completes on its own, so
+ * neither a readiness event nor a second system call is needed. Other
+ * operations are submitted as polls, and performed once their descriptor is
+ * ready. Submissions are batched: operations started by the thread running a
+ * single-threaded scheduler are submitted by the next wait, in the same
+ * system call, and completions are reaped in batches from the completion
+ * queue, from which the operations are completed directly.
+ *
+ * Descriptors are entered in the ring's table of fixed files, which spares
+ * the kernel looking them up on each operation, and buffers may be registered
+ * (see @ref register_buffer), which spares it mapping them.
+ *
+ * If io_uring is unavailable, e.g. because the kernel is too old or io_uring
+ * is forbidden by a seccomp policy, everything is forwarded to an @ref
+ * epoll_reactor instead.
+ */
+class uring_reactor
+{
+#if FREETURES_HAS_THREADS
+    using mutex_type = std::mutex;
+#else
+    struct mutex_type
+    {
+        void lock() noexcept {}
+        void unlock() noexcept {}
+    };
+#endif
+
+public:
+    using op_type = reactor_op::op_type;
+
+    /** The reactor's state of a registered descriptor. */
+    class descriptor_state
+    {
+        friend class uring_reactor;
+
+        // The operations started on the descriptor, by kind. Only the first
+        // of each queue is in the ring, so that they complete in order.
+        op_queue<reactor_op> op_queues_[reactor_op::max_ops];
+        int descriptor_;
+        // The slot of the descriptor in the table of fixed files, or -1 if
+        // the table was full.
+        int fixed_index_ = -1;
+        // The registration with the fallback reactor, if it's used.
+        epoll_reactor::per_descriptor_data readiness_data_ = nullptr;
+        // Set once the descriptor is deregistered, after which the state
+        // lives until the completions of its operations are reaped.
+        bool shutdown_ = false;
+        // Links deregistered states whose last operation completed, until
+        // they can be freed.
+        descriptor_state* next_free_ = nullptr;
+        // Links the states that are registered, or whose operations are still
+        // in the ring.
+        descriptor_state* prev_ = nullptr;
+        descriptor_state* next_ = nullptr;
+
+        explicit descriptor_state(int descriptor) : descriptor_(descriptor) {}
+    };
+
+    /** What an I/O object keeps of its registration. */
+    using per_descriptor_data = descriptor_state*;
+
+private:
+    static constexpr unsigned num_entries = 256;
+    static constexpr unsigned max_fixed_files = 64;
+    static constexpr unsigned max_registered_buffers = 16;
+
+    // The user data of a completion is the address of the state of the
+    // descriptor whose operation it completes, tagged in the low bits with
+    // the kind of the operation, and whether it was submitted as a transfer
+    // or as a poll.
+    static constexpr std::uint64_t tag_mask = 7;
+    static constexpr std::uint64_t transfer_tag = 1; // + op_type
+    static constexpr std::uint64_t poll_tag = 4; // + op_type
+    // Completions that carry no operation.
+    static constexpr std::uint64_t ignored_data = 0;
+    static constexpr std::uint64_t interrupter_data = tag_mask;
+
+    struct registered_buffer
+    {
+        char* data;
+        std::size_t size;
+    };
+
+    scheduler& scheduler_;
+
+    // Set if io_uring is unavailable, in which case it does all the work.
+    std::unique_ptr<epoll_reactor> readiness_;
+
+    int ring_descriptor_ = -1;
+    void* ring_ = nullptr;
+    std::size_t ring_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    std::size_t sqes_size_ = 0;
+
+    // The submission queue, shared with the kernel.
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+
+    // The completion queue, shared with the kernel. Only the thread running
+    // the reactor touches it.
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+    unsigned cq_mask_ = 0;
+
+    // Guards the submission queue, the operation queues of the descriptors,
+    // and the tables of fixed files and registered buffers.
+    mutex_type mutex_;
+    // The entries queued but not yet submitted to the kernel.
+    unsigned num_unsubmitted_ = 0;
+    // The entries that found the submission queue full, and the kernel
+    // unwilling to consume it (e.g. while the completion queue overflows), in
+    // order. Moved into the queue by @ref run once it reaped completions.
+    std::vector<io_uring_sqe> backlog_;
+    std::vector<int> free_fixed_files_;
+    registered_buffer buffers_[max_registered_buffers] = {};
+    unsigned num_buffers_ = 0;
+    // The states that are registered, or whose operations are still in the
+    // ring, so that their operations can be aborted and reaped when the
+    // scheduler is destroyed.
+    descriptor_state* states_ = nullptr;
+
+    // Wakes a thread waiting for completions: its read descriptor is polled
+    // through the ring, and the poll is renewed by the reactor after each
+    // wakeup.
+    interrupter interrupter_;
+    bool interrupter_polled_ = false;
+
+public:
+    explicit uring_reactor(scheduler& s);
+    ~uring_reactor();
+
+    uring_reactor(const uring_reactor&) = delete;
+    uring_reactor& operator=(const uring_reactor&) = delete;
+
+    /** Whether operations go through io_uring, rather than through epoll. */
+    bool uses_io_uring() const noexcept
+    {
+        return !readiness_;
+    }
+
+    /**
+     * Registers @p descriptor, which must be in non-blocking mode, with the
+     * reactor, and stores the state of the registration in @p data.
+     */
+    std::error_code register_descriptor(int descriptor, per_descriptor_data& data);
+
+    /**
+     * Removes the registration of a descriptor, and cancels its pending
+     * operations, which complete with `std::errc::operation_canceled`, those
+     * in the ring once the reactor reaps their completions. Must be called
+     * before the descriptor is closed.
+     */
+    void deregister_descriptor(per_descriptor_data& data);
+
+    /**
+     * Registers @p size bytes at @p data with the kernel, which then keeps
+     * them mapped, so that reads and writes into them need not map them each
+     * time. The memory must stay valid for as long as the reactor lives.
+     */
+    std::error_code register_buffer(void* data, std::size_t size);
+
+    /**
+     * Starts operation @p op of kind @p type on the descriptor of @p data,
+     * once the operations of the same kind started before it complete. The
+     * reactor owns the operation until it completes, and keeps the scheduler
+     * from running out of work while it's pending.
+     */
+    void start_op(op_type type, per_descriptor_data& data, reactor_op* op);
+
+    /**
+     * Cancels the pending operations of a descriptor, which complete with
+     * `std::errc::operation_canceled`.
+     */
+    void cancel_ops(per_descriptor_data& data);
+
+    /**
+     * Withdraws operation @p op of kind @p type from the descriptor of @p
+     * data, if it's still queued. If it's in the ring, the kernel is asked to
+     * cancel it, and it completes with `std::errc::operation_canceled` once
+     * the reactor reaps its completion, unless it was done already. May be
+     * called by any thread, as long as the operation hasn't been completed.
+     *
+     * @return True if the operation was withdrawn, in which case it has been
+     * aborted with `std::errc::operation_canceled`, and the caller completes
+     * it, then calls `work_finished` on the scheduler. Otherwise it completes
+     * through the ring, or, if it hasn't been started yet, is aborted by @ref
+     * start_op.
+     */
+    bool cancel_op(op_type type, per_descriptor_data& data, reactor_op* op);
+
+    /**
+     * Aborts the pending operations of all registered descriptors with
+     * `std::errc::operation_canceled`, as the scheduler is destroyed. Those
+     * in the ring are cancelled through it, and complete once @ref run reaps
+     * their completions.
+     */
+    void abort_all_ops();
+
+    /** Whether any operation is still pending, e.g. in the ring. */
+    bool has_pending_ops();
+
+    /** Makes a thread blocked in @ref run return. May be called by any thread. */
+    void interrupt();
+
+    /**
+     * Returns false, unless the reactor falls back to epoll, which arms its
+     * timerfd instead: the ring takes the timeout of a wait in the same system
+     * call that submits and waits, so a timerfd would only cost more.
+     */
+    bool arm_timer(time_point expiry)
+    {
+        return readiness_ && readiness_->arm_timer(expiry);
+    }
+
+    /**
+     * @brief Submits the queued operations, waits for completions and
+     * dispatches them.
+     *
+     * @param timeout The longest time to wait for a completion, or until
+     * @ref interrupt is called. If zero, only reaps completions that already
+     * arrived; if `duration::max()`, waits indefinitely.
+     */
+    void run(duration timeout);
+
+    void stop()
+    {
+    }
+
+private:
+    bool init_ring();
+    void close_ring() noexcept;
+
+    // Returns an entry to fill and then commit. Expects mutex_ to be held,
+    // and submits the queue if it's full. If that fails, the entry goes to
+    // the backlog rather than overwrite one the kernel hasn't consumed.
+    io_uring_sqe* next_sqe();
+    void commit_sqe() noexcept;
+    // Moves as much of the backlog into the submission queue as fits.
+    // Expects mutex_ to be held.
+    void flush_backlog() noexcept;
+    // Submits the entries not yet submitted. Expects mutex_ to be held.
+    void submit();
+
+    // Puts the first operation of kind @p type of a descriptor in the ring.
+    // Expects mutex_ to be held.
+    void submit_op(descriptor_state& state, op_type type);
+    void prepare_transfer(io_uring_sqe& sqe, op_type type,
+            descriptor_state& state, reactor_op* op) const noexcept;
+    void prepare_poll(io_uring_sqe& sqe, op_type type, descriptor_state& state) noexcept;
+    void prepare_cancel(io_uring_sqe& sqe, int descriptor) noexcept;
+    void prepare_cancel_one(io_uring_sqe& sqe, std::uint64_t user_data) noexcept;
+
+    // Aborts the operations of a descriptor that are not in the ring, and
+    // cancels those that are. Returns whether any are. Expects mutex_ to be
+    // held.
+    bool abort_ops(descriptor_state& state, op_queue<reactor_op>& aborted);
+
+    // Links @p state into, or unlinks it from, states_. Expects mutex_ to be
+    // held.
+    void link_state(descriptor_state& state) noexcept;
+    void unlink_state(descriptor_state& state) noexcept;
+
+    // Interprets a completion, and collects its operation in @p completed if
+    // it's done, and the state of its descriptor in @p dead if it was the
+    // last operation of a deregistered descriptor. Expects mutex_ to be held.
+    void handle_cqe(const io_uring_cqe& cqe, op_queue<reactor_op>& completed,
+            descriptor_state*& dead);
+    void complete_ops(op_queue<reactor_op>& ops);
+
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags,
+            const void* arg = nullptr, std::size_t arg_size = 0) noexcept;
+    std::error_code update_resource(unsigned opcode, unsigned index, const void* data) noexcept;
+};
+
+} // detail
+} // ft
+
+#endif // FREETURES_HAS_IO_URING
+
+#endif
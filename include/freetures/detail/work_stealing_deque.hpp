@@ -0,0 +1,133 @@
+#ifndef FREETURES_WORK_STEALING_DEQUE_HPP
+#define FREETURES_WORK_STEALING_DEQUE_HPP
+
+#include <atomic>
+#include <cstddef>
+
+namespace ft {
+namespace detail {
+
+/**
+ * A bounded Chase-Lev work-stealing deque of operation pointers.
+ *
+ * The owning thread pushes and pops at the bottom (LIFO, which keeps the most
+ * recently produced and thus cache-hot work local), while any other thread may
+ * steal from the top (FIFO). Only @ref push and @ref pop may be called by the
+ * owner, @ref steal may be called by anyone.
+ *
+ * Unlike the original algorithm the buffer is never grown, so that no buffer
+ * ever has to be reclaimed while a thief may still read it. Instead @ref push
+ * fails when the deque is full and the caller is expected to spill the
+ * operation into a shared queue.
+ *
+ * The memory orderings follow "Correct and Efficient Work-Stealing for Weak
+ * Memory Models" (Lê, Pop, Cohen, Zappa Nardelli, 2013).
+ */
+template<typename Op, std::size_t Capacity = 256>
+class work_stealing_deque
+{
+    static_assert(Capacity > 0 and (Capacity & (Capacity - 1)) == 0,
+            "work_stealing_deque capacity must be a power of two");
+
+    static constexpr std::ptrdiff_t mask = Capacity - 1;
+
+    std::atomic<std::ptrdiff_t> top_{0};
+    std::atomic<std::ptrdiff_t> bottom_{0};
+    std::atomic<Op*> buffer_[Capacity];
+
+public:
+    work_stealing_deque()
+    {
+        for(auto& slot : buffer_) {
+            slot.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    work_stealing_deque(const work_stealing_deque&) = delete;
+    work_stealing_deque& operator=(const work_stealing_deque&) = delete;
+
+    /**
+     * Pushes @p op to the bottom of the deque. Must only be called by the
+     * owner.
+     *
+     * @return False if the deque is full, in which case @p op is not enqueued.
+     */
+    bool push(Op* op) noexcept
+    {
+        const auto b = bottom_.load(std::memory_order_relaxed);
+        const auto t = top_.load(std::memory_order_acquire);
+        if(b - t > mask) {
+            return false;
+        }
+        buffer_[b & mask].store(op, std::memory_order_relaxed);
+        // A release store rather than the paper's release fence: equivalent on
+        // the targets we care about and understood by thread sanitizers.
+        bottom_.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Pops the most recently pushed operation. Must only be called by the
+     * owner.
+     *
+     * @return The operation, or nullptr if the deque is empty.
+     */
+    Op* pop() noexcept
+    {
+        const auto b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = top_.load(std::memory_order_relaxed);
+        Op* op = nullptr;
+        if(t <= b) {
+            op = buffer_[b & mask].load(std::memory_order_relaxed);
+            if(t == b) {
+                // This is the last element, so we race with thieves for it.
+                if(!top_.compare_exchange_strong(t, t + 1,
+                        std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    op = nullptr;
+                }
+                bottom_.store(b + 1, std::memory_order_relaxed);
+            }
+        } else {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return op;
+    }
+
+    /**
+     * Steals the least recently pushed operation. May be called by any thread.
+     *
+     * @return The operation, or nullptr if the deque is empty or another thread
+     * won the race for the top element.
+     */
+    Op* steal() noexcept
+    {
+        auto t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const auto b = bottom_.load(std::memory_order_acquire);
+        if(t < b) {
+            Op* op = buffer_[t & mask].load(std::memory_order_relaxed);
+            if(!top_.compare_exchange_strong(t, t + 1,
+                    std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                return nullptr;
+            }
+            return op;
+        }
+        return nullptr;
+    }
+
+    /** A snapshot of whether the deque is empty. May be called by any thread. */
+    bool empty() const noexcept
+    {
+        const auto t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const auto b = bottom_.load(std::memory_order_acquire);
+        return b <= t;
+    }
+};
+
+} // detail
+} // ft
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef FREETURES_ERROR_HPP
+#define FREETURES_ERROR_HPP
+
+#include <atomic>
+#include <cstdlib>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include "detail/config.hpp"
+
+namespace ft {
+
+/**
+ * @brief The errors reported by freetures itself, in the `ft::future_category`
+ * error category.
+ */
+enum class future_errc
+{
+    // The operation of a future timed out (see @ref future::on_timeout).
+    timed_out = 1,
+    // The operation of a future was cancelled (see @ref future::on_cancel).
+    cancelled,
+    // A promise was fulfilled more than once.
+    promise_already_satisfied,
+    // A promise or future without a shared state was used.
+    no_state,
+    // A future was continued more than once.
+    continuation_already_attached,
+    // The handlers of a future were invoked before its promise was fulfilled.
+    not_ready,
+    // A spawned task exited with an exception other than std::system_error.
+    unhandled_exception,
+};
+
+namespace detail {
+
+class future_category_impl : public std::error_category
+{
+public:
+    const char* name() const noexcept override
+    {
+        return "freetures";
+    }
+
+    std::string message(int ev) const override
+    {
+        switch(static_cast<future_errc>(ev)) {
+        case future_errc::timed_out: return "operation timed out";
+        case future_errc::cancelled: return "operation cancelled";
+        case future_errc::promise_already_satisfied: return "promise already satisfied";
+        case future_errc::no_state: return "no associated state";
+        case future_errc::continuation_already_attached: return "continuation already attached";
+        case future_errc::not_ready: return "promise not ready";
+        case future_errc::unhandled_exception: return "unhandled exception in task";
+        }
+        return "unknown error";
+    }
+};
+
+} // detail
+
+inline const std::error_category& future_category() noexcept
+{
+    static const detail::future_category_impl category;
+    return category;
+}
+
+inline std::error_code make_error_code(future_errc e) noexcept
+{
+    return std::error_code(static_cast<int>(e), future_category());
+}
+
+/**
+ * @brief A function that is called on an error from which freetures can't
+ * recover without exceptions, e.g. a promise that is fulfilled twice.
+ *
+ * @p what names the operation that failed. The handler must not return: if it
+ * does, the program is aborted.
+ */
+using fatal_handler = void (*)(std::error_code error, const char* what);
+
+namespace detail {
+
+inline std::atomic<fatal_handler>& fatal_handler_slot() noexcept
+{
+    static std::atomic<fatal_handler> handler{nullptr};
+    return handler;
+}
+
+/** Reports an unrecoverable error to the fatal handler, and aborts. */
+[[noreturn]] inline void fatal(std::error_code error, const char* what) noexcept
+{
+    if(fatal_handler h = fatal_handler_slot().load(std::memory_order_acquire)) {
+        h(error, what);
+    }
+    std::abort();
+}
+
+/**
+ * Reports misuse of the library: by throwing a `std::system_error` if
+ * exceptions are enabled, and through @ref fatal otherwise.
+ */
+[[noreturn]] inline void throw_error(std::error_code error, const char* what)
+{
+#if FREETURES_HAS_EXCEPTIONS
+    throw std::system_error(error, what);
+#else
+    fatal(error, what);
+#endif
+}
+
+} // detail
+
+/**
+ * @brief Installs the handler of unrecoverable errors, which, when built
+ * without exceptions, replaces throwing (see FREETURES_HAS_EXCEPTIONS). By
+ * default the program is merely aborted.
+ *
+ * The handler may be installed from any thread.
+ *
+ * @return The previous handler.
+ */
+inline fatal_handler set_fatal_handler(fatal_handler h) noexcept
+{
+    return detail::fatal_handler_slot().exchange(h, std::memory_order_acq_rel);
+}
+
+} // ft
+
+namespace std {
+
+template<>
+struct is_error_code_enum<ft::future_errc> : true_type {};
+
+} // std
+
+#endif
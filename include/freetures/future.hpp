@@ -1,15 +1,81 @@
 #ifndef FREETURES_FUTURE_HPP 
 #define FREETURES_FUTURE_HPP 
 
-#include <memory>
+#include <cassert>
 #include <type_traits>
 
+#include "error.hpp"
 #include "promise.hpp"
+#include "detail/ref_count.hpp"
 #include "detail/shared_state.hpp"
 #include "detail/type_traits.hpp"
+#include "detail/unique_function.hpp"
 
 namespace ft {
 
+namespace detail {
+
+/**
+ * Makes the continuations through which `then` chains handlers to futures
+ * (and to shared futures, see shared_future.hpp). A `Sink` is invoked with the
+ * `Completion` of the preceding future: if it has a value, the handler is
+ * invoked with it, and the future that `then` returned, whose promise the
+ * continuation holds, is fulfilled with the handler's result; otherwise the
+ * handler is skipped, and the error or timeout is passed on to that future.
+ */
+struct chain
+{
+    /** For handlers that return a value. */
+    template<typename Sink, typename Completion, typename U, typename Handler>
+    static Sink make(promise<U> p, Handler&& handler, std::false_type /*returns_future*/)
+    {
+        return Sink([p = std::move(p), handler = std::forward<Handler>(handler)](
+                Completion c) mutable
+        {
+            if(c.has_value()) {
+                p.set_value(handler(std::move(c.value())));
+            } else {
+                p.set_failure(c.error());
+            }
+            // The promise is fulfilled right away, so notify its scheduler,
+            // which may invoke its continuation right here if it allows
+            // inline execution.
+            auto& scheduler = p.state_->get_scheduler();
+            scheduler.dispatch_ready_promise(std::move(p));
+        });
+    }
+
+    /**
+     * For handlers that return a future.
+     *
+     * The future the handler returns doesn't exist until the handler has run,
+     * but the caller needs a future to continue right away. So the caller gets
+     * the future of an outer state, which, once the handler has returned the
+     * inner future, forwards to the inner state: the outer continuation,
+     * whether it's attached before or after that, is moved to the inner state,
+     * which invokes it directly when it becomes ready.
+     */
+    template<typename Sink, typename Completion, typename U, typename Handler>
+    static Sink make(promise<U> p, Handler&& handler, std::true_type /*returns_future*/)
+    {
+        return Sink([p = std::move(p), handler = std::forward<Handler>(handler)](
+                Completion c) mutable
+        {
+            if(!c.has_value()) {
+                p.set_failure(c.error());
+                auto& scheduler = p.state_->get_scheduler();
+                scheduler.dispatch_ready_promise(std::move(p));
+                return;
+            }
+            auto inner_future = handler(std::move(c.value()));
+            assert(inner_future.state_);
+            p.state_->forward_to(std::move(inner_future.state_));
+        });
+    }
+};
+
+} // detail
+
 /**
  * @code
  * future<int> async_operation();
@@ -38,11 +104,15 @@ struct future
     template<typename U>
     friend class future;
 
-    std::weak_ptr<detail::shared_state<T>> state_;
+    // The future shares ownership of the state with its promise, so the future
+    // is just a pointer.
+    detail::intrusive_ptr<detail::shared_state<T>> state_;
 
 public:
     // TODO cleaner API
-    explicit future(std::weak_ptr<detail::shared_state<T>> state) : state_(state) {}
+    explicit future(detail::intrusive_ptr<detail::shared_state<T>> state)
+        : state_(std::move(state))
+    {}
 
     /**
      * @brief Sets a handler to be invoked with the result of the future, once
@@ -94,17 +164,19 @@ public:
             future<null_tag>
         >::type
     {
-        return attach_continuation<Handler>([h](T t) -> null_tag {
-            h(std::move(t));
-            return null_tag();
-        });
+        return attach_continuation(
+            [h = std::forward<Handler>(h)](T t) mutable -> null_tag {
+                h(std::move(t));
+                return null_tag();
+            });
     }
 
     /**
      * @brief Sets a handler to be invoked if the future resulted in an error.
      *
-     * Handler must return either a future wrapping the same type as this future
-     * (i.e. `future<T>`), or a value of type T.
+     * The error is also passed on to the future returned by @ref then, so an
+     * error handler at the end of a chain sees the errors of all the futures
+     * before it, and none of the continuations in between are invoked.
      *
      * @code
      * future<int> async_operation();
@@ -125,14 +197,17 @@ public:
     template<typename Handler>
     future<T>& on_error(Handler&& h)
     {
-        return attach_error_handler<Handler>(std::forward<Handler>(h));
+        assert(state_);
+        state_->attach_error_handler(detail::unique_function<void(std::error_code)>(
+                std::forward<Handler>(h)));
+        return *this;
     }
 
     /**
      * @brief Sets a handler to be invoked if the future has timed out.
      *
-     * Handler must return either a future wrapping the same type as this future
-     * (i.e. `future<T>`), or a value of type T.
+     * Like errors, timeouts are passed on to the future returned by @ref then
+     * (to its continuation, they appear as the error `future_errc::timed_out`).
      *
      * @code
      * future<int> async_operation();
@@ -156,167 +231,64 @@ public:
     template<typename Handler>
     future<T>& on_timeout(Handler&& h)
     {
-        return attach_timeout_handler<Handler>(std::forward<Handler>(h));
+        assert(state_);
+        state_->attach_timeout_handler(
+                detail::unique_function<void()>(std::forward<Handler>(h)));
+        return *this;
     }
 
-private:
     /**
-     * @brief Specialization for a `then` continuation variant that returns a future.
+     * @brief Sets a handler to be invoked if the future is cancelled.
+     *
+     * A future is cancelled if its operation is cancelled (see @ref
+     * cancellation_source), or if its promise is destroyed without having been
+     * fulfilled. The continuation attached with @ref then is then not invoked,
+     * and the future it returned is cancelled in turn, so cancelling an
+     * operation cancels the whole chain of futures that follows it.
+     *
+     * @code
+     * scheduler.wait(ft::seconds(1), token)
+     *     .then([](ft::null_tag) {
+     *         // Not invoked if the wait is cancelled.
+     *         return 42;
+     *     }).on_cancel([] {
+     *         // But this is, either way.
+     *     });
+     * @endcode
+     *
+     * @param h The handler, which takes no arguments.
+     *
+     * @return A reference to `*this`.
      */
-    template<
-        typename Handler,
-        typename HandlerTraits = callable_traits<Handler, T>,
-        typename U = typename HandlerTraits::inner_result_type
-    > auto attach_continuation(Handler&& handler)
-        -> typename std::enable_if<HandlerTraits::returns_future, future<U>>::type
+    template<typename Handler>
+    future<T>& on_cancel(Handler&& h)
     {
-        auto state = state_.lock();
-        if(!state) {
-            throw "TODO add proper exception";
-        }
-
-        // Handler returns a future, which means that it already has an
-        // associated promise (only promises can create futures).
-        //
-        // The tricky part, however, is that this future (and thus its
-        // associated promise) do not yet exist (since the future is returned by
-        // handler, which hasn't run). Thus we create a bogus future-promise
-        // pair, to which a continuation and possibly error and timeout handlers
-        // may be attached, and when this continuation is invoked, we transfer
-        // these handlers to the actual future the handler returns, so that the
-        // scheduler associated with the future returned by handler can execute
-        // them.
-        promise<U> bogus_handler_promise(state->get_scheduler());
-        auto bogus_handler_future = bogus_handler_promise.get_future();
-        detail::continuation<U> cont([this, bogus_handler_promise, handler](T&& t) mutable
-        {
-            // Invoke the handler with the result to retrieve its future.
-            auto handler_future = handler(std::forward<T>(t));
-            auto handler_state = handler_future.state_.lock();
-            if(!handler_state) {
-                // TODO
-                assert(0);
-                return;
-            }
-
-            // Grab the future associated with our bogus promise so that we can
-            // access its shared state.
-            auto bogus_handler_future = bogus_handler_promise.get_future();
-            auto bogus_state = bogus_handler_future.state_.lock();
-            // This shouldn't happen.
-            if(!bogus_state) { assert(0); }
-
-            // Then move any handlers registered with the bogus future to the
-            // actual future. This way, when the future returned by handler will
-            // become ready, the scheduler can call them.
-            bogus_state->move_handlers_to(*handler_state);
-        });
-
-        state->attach_continuation(std::move(cont));
-
-        return bogus_handler_future;
+        assert(state_);
+        state_->attach_cancel_handler(
+                detail::unique_function<void()>(std::forward<Handler>(h)));
+        return *this;
     }
 
-    /**
-     * @brief Specialization for a `then` continuation variant that returns
-     * a value.
-     *
-     * Since invoking this continuation returns non-future value, it means the
-     * future in which it is going to be wrapped immediately becomes ready. The
-     * reason it is wrapped in a future is so the continuation chain is not
-     * broken.
-     */
+private:
     template<
         typename Handler,
         typename HandlerTraits = callable_traits<Handler, T>,
         typename U = typename HandlerTraits::inner_result_type
-    > auto attach_continuation(Handler&& handler)
-        -> typename std::enable_if<not HandlerTraits::returns_future, future<U>>::type
+    > future<U> attach_continuation(Handler&& handler)
     {
-        auto state = state_.lock();
-        if(!state) {
-            throw "TODO add proper exception";
+        if(!state_) {
+            detail::throw_error(future_errc::no_state, "cannot continue an empty future");
         }
-
-        // Since handler returns a value, we need to create the promise
-        // ourselves. Usually promises are created directly by schedulers, so this
-        // means that we'll have to associate this new promise with the
-        // scheduler of this future.
-        promise<U> handler_promise(state->get_scheduler());
+        // Usually promises are created directly by schedulers, but the future
+        // of the handler belongs to the scheduler of this future.
+        promise<U> handler_promise(state_->get_scheduler());
         auto handler_future = handler_promise.get_future();
-        detail::continuation<U> cont([handler_promise, handler](T&& t) mutable
-        {
-            auto result = handler(std::move(t));
-            // Since this continuation is only invoked if no error or timeout
-            // occurred, `t` is valid, which needs to be passed to
-            // `handler_future`.
-            handler_promise.set_value(std::move(result));
-            // Since handler returns a value the promise effectively immdiately
-            // becomes fulfilled, notify `handler_future`'s executor that this
-            // promise has been fulfilled  so that its continuation can be
-            // invoked.
-            auto future = handler_promise.get_future();
-            auto state = future.state_.lock();
-            assert(state);
-            state->get_scheduler().post_ready_promise(std::move(handler_promise));
-        });
-
-        state->attach_continuation(std::move(cont));
-
+        state_->attach_continuation(
+            detail::chain::make<detail::continuation<T>, detail::completion<T>>(
+                std::move(handler_promise), std::forward<Handler>(handler),
+                std::integral_constant<bool, HandlerTraits::returns_future>()));
         return handler_future;
     }
-
-    /**
-     * @brief Specialization for an `on_error` continuation variant that returns
-     * a future.
-     */
-    template<
-        typename Handler,
-        typename HandlerTraits = callable_traits<Handler, T>,
-        typename U = typename HandlerTraits::inner_result_type
-    > auto attach_error_handler(Handler&& handler)
-        -> typename std::enable_if<HandlerTraits::returns_future, future<U>>::type
-    {
-    }
-
-    /**
-     * @brief Specialization for an `on_error` continuation variant that returns
-     * a value.
-     */
-    template<
-        typename Handler,
-        typename HandlerTraits = callable_traits<Handler, T>,
-        typename U = typename HandlerTraits::inner_result_type
-    > auto attach_error_handler(Handler&& handler)
-        -> typename std::enable_if<not HandlerTraits::returns_future, future<U>>::type
-    {
-    }
-
-    /**
-     * @brief Specialization for an `on_timeout` continuation variant that returns
-     * a future.
-     */
-    template<
-        typename Handler,
-        typename HandlerTraits = callable_traits<Handler, T>,
-        typename U = typename HandlerTraits::inner_result_type
-    > auto attach_timeout_handler(Handler&& h)
-        -> typename std::enable_if<HandlerTraits::returns_future, future<U>>::type
-    {
-    }
-
-    /**
-     * @brief Specialization for an `on_timeout` continuation variant that returns
-     * a value.
-     */
-    template<
-        typename Handler,
-        typename HandlerTraits = callable_traits<Handler, T>,
-        typename U = typename HandlerTraits::inner_result_type
-    > auto attach_timeout_handler(Handler&& h)
-        -> typename std::enable_if<not HandlerTraits::returns_future, future<U>>::type
-    {
-    }
 };
 
 /**
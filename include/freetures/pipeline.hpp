@@ -0,0 +1,127 @@
+#ifndef FREETURES_PIPELINE_HPP
+#define FREETURES_PIPELINE_HPP
+
+#include <type_traits>
+#include <utility>
+
+namespace ft {
+namespace detail {
+
+/**
+ * Invokes `g` with the result of `f`, or with no arguments if `f` returns
+ * void. Both are stored by value, so the compiler sees the whole chain of
+ * stages as a single, statically typed function.
+ */
+template<typename F, typename G>
+class composed_stage
+{
+    F f_;
+    G g_;
+
+public:
+    template<typename FF, typename GG>
+    composed_stage(FF&& f, GG&& g)
+        : f_(std::forward<FF>(f))
+        , g_(std::forward<GG>(g))
+    {}
+
+    template<typename... Args>
+    decltype(auto) operator()(Args&&... args)
+    {
+        using f_result = decltype(f_(std::forward<Args>(args)...));
+        return invoke(std::is_void<f_result>(), std::forward<Args>(args)...);
+    }
+
+private:
+    template<typename... Args>
+    decltype(auto) invoke(std::false_type /*is_void*/, Args&&... args)
+    {
+        return g_(f_(std::forward<Args>(args)...));
+    }
+
+    template<typename... Args>
+    decltype(auto) invoke(std::true_type /*is_void*/, Args&&... args)
+    {
+        f_(std::forward<Args>(args)...);
+        return g_();
+    }
+};
+
+} // detail
+
+/**
+ * @brief A lazily composed chain of synchronous stages.
+ *
+ * Unlike @ref future::then, which allocates a promise, a shared state and a
+ * continuation per step and makes each step a separate trip through the
+ * scheduler, `pipeline::then` merely wraps the chain built so far and the new
+ * stage in a new, statically typed function object. Nothing is executed or
+ * allocated until the pipeline is handed to a scheduler or a future, where the
+ * whole chain is a single function (and thus a single allocation, if any).
+ *
+ * Each stage is invoked with the result of the previous one (or nothing if it
+ * returned void). The first stage receives whatever the pipeline is invoked
+ * with: nothing if it's posted, or a future's value if it's attached to one.
+ *
+ * @code
+ * ft::scheduler scheduler;
+ * auto parse_reply = ft::pipe([](std::string line) { return trim(line); })
+ *     .then([](std::string line) { return split(line, ','); })
+ *     .then([](std::vector<std::string> fields) { return to_status(fields); });
+ *
+ * // One continuation instead of three.
+ * uart.read_line().then(std::move(parse_reply)).then([](status s) {
+ *     // ...
+ * });
+ *
+ * // A pipeline whose first stage takes no arguments can be posted.
+ * scheduler.post(ft::pipe([] { return 42; }).then([](int x) { return x * 2; }));
+ * @endcode
+ *
+ * Stages are meant to be cheap, synchronous transformations. An asynchronous
+ * step, i.e. one returning a future, must be the last stage of a pipeline,
+ * after which the chain continues with @ref future::then.
+ */
+template<typename F>
+class pipeline
+{
+    F f_;
+
+public:
+    template<
+        typename FF,
+        typename = typename std::enable_if<
+            !std::is_same<typename std::decay<FF>::type, pipeline>::value>::type
+    > explicit pipeline(FF&& f) : f_(std::forward<FF>(f)) {}
+
+    /** @brief Runs the whole chain. */
+    template<typename... Args>
+    decltype(auto) operator()(Args&&... args)
+    {
+        return f_(std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Appends @p g as the last stage of the chain.
+     *
+     * @return The new pipeline, which owns this pipeline's stages.
+     */
+    template<typename G>
+    pipeline<detail::composed_stage<F, typename std::decay<G>::type>>
+    then(G&& g) &&
+    {
+        using composed = detail::composed_stage<F, typename std::decay<G>::type>;
+        return pipeline<composed>(composed(std::move(f_), std::forward<G>(g)));
+    }
+};
+
+/** @brief Starts a @ref pipeline with @p f as its first stage. */
+template<typename F>
+pipeline<typename std::decay<F>::type> pipe(F&& f)
+{
+    return pipeline<typename std::decay<F>::type>(std::forward<F>(f));
+}
+
+} // ft
+
+#endif
@@ -1,31 +1,64 @@
 #ifndef FREETURES_PROMISE_HPP
 #define FREETURES_PROMISE_HPP
 
-#include <memory>
 #include <system_error>
 
 #include "future.hpp"
+#include "detail/ref_count.hpp"
 #include "detail/shared_state.hpp"
 
 namespace ft {
 
+namespace detail {
+struct chain;
+} // detail
+
 template<typename T>
 class promise
 {
-    std::shared_ptr<detail::shared_state<T>> state_;
+    friend class detail::scheduler;
+    friend struct detail::chain;
+    template<typename U>
+    friend class future;
+
+    detail::intrusive_ptr<detail::shared_state<T>> state_;
 
 public:
     promise() = default;
 
     /**
-     * Constructs the promise and its associated shared state.
+     * Constructs the promise and its associated shared state, which is
+     * allocated from the pool of @p s.
      */
     explicit promise(detail::scheduler& s)
-        : state_(std::make_shared<detail::shared_state<T>>(s))
+        : state_(detail::shared_state<T>::create(s))
     {}
 
+    promise(promise&&) noexcept = default;
+
+    promise& operator=(promise&& other) noexcept
+    {
+        if(this != &other) {
+            abandon();
+            state_ = std::move(other.state_);
+        }
+        return *this;
+    }
+
+    promise(const promise&) = delete;
+    promise& operator=(const promise&) = delete;
+
+    /**
+     * A promise that is destroyed without having been fulfilled cancels its
+     * future (see @ref future::on_cancel).
+     */
+    ~promise()
+    {
+        abandon();
+    }
+
     /** Returns a future associated with this promise. */
-    future<T> get_future() { return {state_}; }
+    future<T> get_future() { return future<T>(state_); }
 
     void set_value(T&& t)
     {
@@ -42,6 +75,24 @@ public:
         state_->set_timeout();
     }
 
+    /**
+     * Passes on the failure of another future: times out the future if @p
+     * error is `future_errc::timed_out`, and fails it with @p error otherwise.
+     */
+    void set_failure(std::error_code error)
+    {
+        state_->set_failure(error);
+    }
+
+    /**
+     * Completes the future on the cancelled path, i.e. its operation was
+     * cancelled before it could produce a result.
+     */
+    void set_cancelled()
+    {
+        state_->set_cancelled();
+    }
+
     bool is_ready() const
     {
         return state_->is_ready();
@@ -54,12 +105,21 @@ public:
      * @note This function should be invoked by the scheduler associated with
      * this promise.
      *
-     * @throw If promise is not ready, an exception is thrown. TODO which?
+     * If the promise is not ready, this is reported as `future_errc::not_ready`
+     * (see @ref detail::throw_error).
      */
     void invoke_handler()
     {
         state_->invoke_handler();
     }
+
+private:
+    void abandon() noexcept
+    {
+        if(state_) {
+            state_->abandon();
+        }
+    }
 };
 
 } // ft
@@ -1,17 +1,69 @@
 #ifndef FREETURES_SCHEDULER_HPP
 #define FREETURES_SCHEDULER_HPP
 
+#include <cstddef>
+#include <system_error>
+
+#include "cancellation.hpp"
 #include "time.hpp"
 #include "future.hpp"
 #include "detail/type_traits.hpp"
 #include "detail/scheduler.hpp"
+#include "detail/impl/scheduler.ipp"
+#include "detail/impl/select_reactor.ipp"
+#include "detail/impl/epoll_reactor.ipp"
+#include "detail/impl/uring_reactor.ipp"
 
 namespace ft {
 
+class stream_descriptor;
+class timer;
+
+namespace detail {
+struct scheduler_access;
+} // detail
+
 class scheduler
 {
+    friend class stream_descriptor;
+    friend class timer;
+    friend struct detail::scheduler_access;
+
     detail::scheduler impl_;
 public:
+    class work_guard;
+
+    /** @brief The occupancy of each size class of the promise pool. */
+    using pool_usage = detail::slab_allocator::usage;
+
+    /**
+     * @brief Constructs a scheduler that is run by a single thread.
+     */
+    scheduler() = default;
+
+    /**
+     * @brief Constructs a scheduler that may be run by up to @p
+     * concurrency_hint threads simultaneously.
+     *
+     * Each thread calling @ref run keeps the work it produces in its own
+     * deque, and steals from the other threads' deques when it has nothing
+     * left to do. The reactor is polled by one thread at a time.
+     *
+     * @code
+     * ft::scheduler scheduler(4);
+     * // Post work...
+     * std::vector<std::thread> threads;
+     * for(int i = 0; i < 3; ++i) {
+     *     threads.emplace_back([&scheduler] { scheduler.run(); });
+     * }
+     * scheduler.run();
+     * for(auto& t : threads) { t.join(); }
+     * @endcode
+     */
+    explicit scheduler(std::size_t concurrency_hint)
+        : impl_(concurrency_hint)
+    {}
+
     /**
      * @brief Posts a function for invocation by @ref run.
      *
@@ -31,6 +83,10 @@ public:
      * scheduler.run();
      * @endcode
      * 
+     * This function may be called from any thread. Posting from a thread that
+     * isn't running the scheduler is lock-free and only makes a system call if
+     * the scheduler is blocked waiting for events.
+     *
      * @param f The function which will be executed by @ref run. It is guaranteed
      * not to be invoked from within this function.
      *
@@ -39,8 +95,9 @@ public:
      */
     template<
         typename F,
-        typename R = typename callable_traits<F, void>::inner_result_type,
-        typename = typename std::enable_if<is_callable<F>::value>::type
+        typename R = typename detail::non_void<
+            typename callable_traits<F, void>::inner_result_type>::type,
+        typename = typename std::enable_if<is_callable<F()>::value>::type
     > future<R> post(F&& f)
     {
         return impl_.post(std::forward<F>(f));
@@ -57,17 +114,21 @@ public:
      * @param f The function which will be executed by @p run. It is guaranteed
      * not to be invoked from within this function.
      * @param delay The minimum time by which the invocation of @p f is delayed.
+     * @param token If cancelled before the delay has passed, @p f is not
+     * invoked and the returned future is cancelled instead.
      *
      * @return A future through which the result of invoking @p f, once
      * it's been executed, may be accessed.
      */
     template<
         typename F,
-        typename R = typename callable_traits<F, void>::inner_result_type,
-        typename = typename std::enable_if<is_callable<F>::value>::type
-    > future<R> defer(F&& f, duration delay)
+        typename R = typename detail::non_void<
+            typename callable_traits<F, void>::inner_result_type>::type,
+        typename = typename std::enable_if<is_callable<F()>::value>::type
+    > future<R> defer(F&& f, duration delay,
+            const cancellation_token& token = cancellation_token())
     {
-        return impl_.defer(std::forward<F>(f), delay);
+        return impl_.defer(std::forward<F>(f), delay, token.state_);
     }
 
     /**
@@ -81,21 +142,45 @@ public:
      *     event_generator.kick();
      * }, time::seconds(1));
      * @endcode
-     * 
+     *
+     * The invocations are scheduled on a fixed grid, so they don't drift even
+     * if some of them are late. The repetition runs until @p token is
+     * cancelled, or until the scheduler is destroyed. (Unless the scheduler is
+     * run by a single thread and the token is cancelled by that thread, the
+     * function is no longer invoked, but the repetition is only withdrawn at
+     * its next deadline.) For more control, such as changing the function, use an
+     * @ref ft::timer.
+     *
      * @param f The function which will be executed by @p run. It is guaranteed
      * not to be invoked from within this function.
      * @param frequency The interval that defines how frequently @p is going to
      * be invoked.
+     * @param policy What to do about the invocations missed while @p f (or
+     * another function) overran its time.
+     * @param token Stops the repetition once cancelled.
      *
      * @return Since the function is repeatedly invoked, no future is returned,
      * since attaching a continuation would not make sense.
      */
     template<
         typename F,
-        typename = typename std::enable_if<is_callable<F>::value>::type
-    > void repeat(F&& f, duration frequency)
+        typename = typename std::enable_if<is_callable<F()>::value
+            || is_callable<F(std::size_t)>::value>::type
+    > void repeat(F&& f, duration frequency,
+            catch_up policy = catch_up::fire_all,
+            const cancellation_token& token = cancellation_token())
+    {
+        impl_.repeat(std::forward<F>(f), frequency, policy, token.state_);
+    }
+
+    /** @brief Like the above, with catch_up::fire_all. */
+    template<
+        typename F,
+        typename = typename std::enable_if<is_callable<F()>::value
+            || is_callable<F(std::size_t)>::value>::type
+    > void repeat(F&& f, duration frequency, const cancellation_token& token)
     {
-        impl_.repeat(std::forward<F>(f), frequency);
+        impl_.repeat(std::forward<F>(f), frequency, catch_up::fire_all, token.state_);
     }
 
     /**
@@ -115,11 +200,13 @@ public:
      * });
      * @endcode
      *
-     * @
+     * If @p token is cancelled before @p delay has passed, the timer is
+     * withdrawn and the returned future is cancelled.
      */
-    void_future wait(duration delay)
+    void_future wait(duration delay,
+            const cancellation_token& token = cancellation_token())
     {
-        //return impl_.wait(delay);
+        return impl_.wait(delay, token.state_);
     }
 
     /**
@@ -128,16 +215,154 @@ public:
      * This function blocks until all ready events have been processed.
      * This means that asynchronous events *must* be registered before calling
      * run, otherwise the application will never start.
+     *
+     * If the scheduler was constructed with a concurrency hint greater than 1,
+     * that many threads may call this function simultaneously.
      */
     void run()
     {
         impl_.run();
     }
 
+    /**
+     * @brief Makes all invocations of @ref run return as soon as possible.
+     *
+     * Subsequent calls to @ref run return immediately until @ref restart is
+     * called.
+     */
     void stop()
     {
         impl_.stop();
     }
+
+    /** @brief Prepares a stopped scheduler to be run again. */
+    void restart()
+    {
+        impl_.restart();
+    }
+
+    /**
+     * @brief Opts in to executing continuations inline.
+     *
+     * By default, each continuation in a chain is enqueued and executed by
+     * @ref run separately, even if the result it needs is available the moment
+     * the previous handler returns. With a non-zero @p depth, such a
+     * continuation is instead executed right away by the thread running the
+     * scheduler, for up to @p depth continuations nested in one another, after
+     * which the chain continues through the queue again so that the stack
+     * doesn't overflow.
+     *
+     * @code
+     * ft::scheduler scheduler;
+     * scheduler.set_max_inline_depth(16);
+     * scheduler.post([] { return read_sample(); })
+     *     .then([](int raw) { return calibrate(raw); })
+     *     .then([](double value) { publish(value); });
+     * @endcode
+     *
+     * Must not be called while the scheduler is running.
+     */
+    void set_max_inline_depth(std::size_t depth) noexcept
+    {
+        impl_.set_max_inline_depth(depth);
+    }
+
+    /**
+     * @brief Registers a buffer that is used for many reads and writes with
+     * the kernel, which then keeps it mapped rather than mapping it for each
+     * of them.
+     *
+     * Only the io_uring backend (see FREETURES_HAS_IO_URING) registers
+     * buffers; otherwise `std::errc::operation_not_supported` is returned, and
+     * the buffer is used like any other. The buffer must outlive the
+     * scheduler.
+     *
+     * @code
+     * static char rx[4096];
+     * scheduler.register_io_buffer(rx, sizeof(rx));
+     * modem.read_some(rx, sizeof(rx)).then([](std::size_t n) {
+     *     // ...
+     * });
+     * @endcode
+     */
+    std::error_code register_io_buffer(void* data, std::size_t size)
+    {
+        return impl_.get_reactor().register_buffer(data, size);
+    }
+
+    /**
+     * @brief Reports how much of the pool, from which the shared states of
+     * the scheduler's promises are allocated, is in use.
+     *
+     * The pool grows in slabs to the peak number of promises alive at the same
+     * time and is not shrunk until the scheduler is destroyed, so this may be
+     * used to size an application's memory budget.
+     *
+     * @code
+     * for(const auto& c : scheduler.get_pool_usage()) {
+     *     std::cout << c.block_size << " byte blocks: "
+     *         << c.num_blocks_in_use << '/' << c.num_blocks << '\n';
+     * }
+     * @endcode
+     */
+    pool_usage get_pool_usage()
+    {
+        return impl_.get_allocator().get_usage();
+    }
+};
+
+/**
+ * @brief Keeps @ref scheduler::run from returning for lack of work for as long
+ * as it exists.
+ *
+ * Functions may be posted to a scheduler from any thread, but unless the
+ * scheduler has outstanding work, its run loop would return rather than wait
+ * for them.
+ *
+ * @code
+ * ft::scheduler scheduler;
+ * ft::scheduler::work_guard work(scheduler);
+ * std::thread sensor([&scheduler] {
+ *     for(;;) {
+ *         auto sample = read_sensor();
+ *         scheduler.post([sample] { process(sample); });
+ *     }
+ * });
+ * scheduler.run();
+ * @endcode
+ */
+class scheduler::work_guard
+{
+    detail::scheduler* scheduler_;
+
+public:
+    explicit work_guard(scheduler& s) : scheduler_(&s.impl_)
+    {
+        scheduler_->work_started();
+    }
+
+    work_guard(work_guard&& other) noexcept : scheduler_(other.scheduler_)
+    {
+        other.scheduler_ = nullptr;
+    }
+
+    work_guard(const work_guard&) = delete;
+    work_guard& operator=(const work_guard&) = delete;
+    work_guard& operator=(work_guard&&) = delete;
+
+    ~work_guard()
+    {
+        reset();
+    }
+
+    /** Releases the guard, after which the scheduler may run out of work. */
+    void reset()
+    {
+        if(scheduler_) {
+            scheduler_->work_finished();
+            scheduler_ = nullptr;
+        }
+    }
 };
 
 } // ft
@@ -0,0 +1,125 @@
+#ifndef FREETURES_SHARED_FUTURE_HPP
+#define FREETURES_SHARED_FUTURE_HPP
+
+#include <type_traits>
+#include <utility>
+
+#include "error.hpp"
+#include "future.hpp"
+#include "promise.hpp"
+#include "detail/broadcast_state.hpp"
+#include "detail/ref_count.hpp"
+#include "detail/shared_state.hpp"
+#include "detail/type_traits.hpp"
+
+namespace ft {
+
+/**
+ * @brief A future that may be continued any number of times.
+ *
+ * A @ref future takes a single continuation. A shared future takes over that
+ * continuation, and hands the future's value to all of its own, each of which
+ * is invoked with a const reference to the same value, rather than a copy.
+ * Shared futures may be copied, and the copies share the value.
+ *
+ * @code
+ * ft::shared_future<std::string> response(modem.query("AT+CSQ"));
+ *
+ * response.then([](const std::string& r) { log(r); });
+ * response.then([](const std::string& r) { metrics.record(r.size()); });
+ * response.then([](const std::string& r) { return parse_signal(r); })
+ *     .then([](int rssi) {
+ *         // The value is copied by nobody along the way.
+ *     });
+ * @endcode
+ *
+ * Continuations attached after the value has arrived are invoked by the
+ * scheduler as well, not by `then`. If the shared future fails or is
+ * cancelled, so are the futures returned by `then`, which is where the
+ * failure can be handled (see @ref future::on_error).
+ */
+template<typename T>
+class shared_future
+{
+    detail::intrusive_ptr<detail::broadcast_state<T>> state_;
+
+public:
+    shared_future() = default;
+
+    /** Takes over the continuation of @p f. */
+    explicit shared_future(future<T> f)
+    {
+        if(!f.state_) {
+            detail::throw_error(future_errc::no_state, "cannot share an empty future");
+        }
+        state_ = detail::broadcast_state<T>::create(f.state_->get_scheduler());
+        f.state_->attach_continuation(detail::continuation<T>(
+                detail::broadcast_continuation<T>(state_)));
+    }
+
+    bool valid() const noexcept
+    {
+        return bool(state_);
+    }
+
+    /**
+     * @brief Sets a handler to be invoked with a const reference to the value
+     * of the future, once it is ready.
+     *
+     * As with @ref future::then, if the handler returns a future, the returned
+     * future is unwrapped.
+     *
+     * @return A future that will contain the return value of the handler.
+     */
+    template<
+        typename Handler,
+        typename HandlerTraits = callable_traits<Handler, const T&>,
+        typename U = typename HandlerTraits::inner_result_type,
+        typename = typename std::enable_if<not std::is_same<U, void>::value>::type
+    > future<U> then(Handler&& h)
+    {
+        return subscribe(std::forward<Handler>(h));
+    }
+
+    /** @brief Specialization for handlers that return void. */
+    template<
+        typename Handler,
+        typename HandlerTraits = callable_traits<Handler, const T&>,
+        typename U = typename HandlerTraits::inner_result_type
+    > auto then(Handler&& h)
+        -> typename std::enable_if<
+            std::is_same<U, void>::value,
+            future<null_tag>
+        >::type
+    {
+        return subscribe(
+            [h = std::forward<Handler>(h)](const T& t) mutable -> null_tag {
+                h(t);
+                return null_tag();
+            });
+    }
+
+private:
+    template<
+        typename Handler,
+        typename HandlerTraits = callable_traits<Handler, const T&>,
+        typename U = typename HandlerTraits::inner_result_type
+    > future<U> subscribe(Handler&& handler)
+    {
+        if(!state_) {
+            detail::throw_error(future_errc::no_state, "cannot continue an empty future");
+        }
+        promise<U> handler_promise(state_->get_scheduler());
+        auto handler_future = handler_promise.get_future();
+        state_->subscribe(detail::chain::make<
+                typename detail::broadcast_state<T>::subscriber,
+                detail::completion<const T>>(
+            std::move(handler_promise), std::forward<Handler>(handler),
+            std::integral_constant<bool, HandlerTraits::returns_future>()));
+        return handler_future;
+    }
+};
+
+} // ft
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef FREETURES_STREAM_DESCRIPTOR_HPP
+#define FREETURES_STREAM_DESCRIPTOR_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cancellation.hpp"
+#include "error.hpp"
+#include "future.hpp"
+#include "scheduler.hpp"
+#include "detail/descriptor_ops.hpp"
+#include "detail/reactor.hpp"
+#include "detail/scheduler.hpp"
+
+namespace ft {
+
+/**
+ * @brief A stream-oriented file descriptor, e.g. a serial port or a pipe,
+ * whose reads and writes complete through futures.
+ *
+ * @code
+ * ft::scheduler scheduler;
+ * ft::stream_descriptor tty(scheduler, ::open("/dev/ttyUSB0", O_RDWR | O_NOCTTY));
+ * char reply[64];
+ * tty.write_some("AT\r", 3)
+ *     .then([&](std::size_t) { return tty.read_some(reply, sizeof(reply)); })
+ *     .then([&](std::size_t n) {
+ *         // The first n bytes of reply are in.
+ *     }).on_error([](std::error_code error) {
+ *         // The port failed.
+ *     });
+ * scheduler.run();
+ * @endcode
+ *
+ * The descriptor is put in non-blocking mode and registered with the
+ * scheduler's reactor once, for as long as the object lives. Operations of
+ * the same kind complete in the order they were started; a read of zero bytes
+ * means the other end has been closed. The buffers must stay valid until the
+ * operation's future is fulfilled.
+ *
+ * Closing the descriptor, or destroying the object, cancels the pending
+ * operations (see @ref future::on_cancel), as does @ref cancel. A single
+ * operation is cancelled through the token it was started with, which
+ * withdraws it from the reactor (or, with io_uring, from the kernel) unless it
+ * has already transferred data, in which case it completes as usual. The
+ * object must be destroyed before its scheduler.
+ */
+class stream_descriptor
+{
+    detail::scheduler& scheduler_;
+    int descriptor_ = -1;
+    detail::reactor::per_descriptor_data data_ = nullptr;
+
+public:
+    /**
+     * Takes over @p descriptor, which is closed when the object is destroyed.
+     */
+    stream_descriptor(scheduler& s, int descriptor)
+        : scheduler_(s.impl_)
+    {
+        if(descriptor < 0) {
+            detail::throw_error(std::make_error_code(std::errc::bad_file_descriptor),
+                    "stream_descriptor");
+        }
+        descriptor_ = descriptor;
+        std::error_code error;
+        const int flags = ::fcntl(descriptor, F_GETFL);
+        if(flags == -1 || ::fcntl(descriptor, F_SETFL, flags | O_NONBLOCK) == -1) {
+            error.assign(errno, std::system_category());
+        } else {
+            error = scheduler_.get_reactor().register_descriptor(descriptor, data_);
+        }
+        if(error) {
+            ::close(descriptor_);
+            detail::throw_error(error, "stream_descriptor");
+        }
+    }
+
+    stream_descriptor(const stream_descriptor&) = delete;
+    stream_descriptor& operator=(const stream_descriptor&) = delete;
+
+    ~stream_descriptor()
+    {
+        close();
+    }
+
+    bool is_open() const noexcept
+    {
+        return descriptor_ != -1;
+    }
+
+    int native_handle() const noexcept
+    {
+        return descriptor_;
+    }
+
+    /**
+     * @brief Reads at least one and at most @p size bytes into @p data.
+     *
+     * @param token If cancelled before anything has been read, the read is
+     * withdrawn and its future cancelled.
+     *
+     * @return A future holding the number of bytes read.
+     */
+    future<std::size_t> read_some(void* data, std::size_t size,
+            const cancellation_token& token = cancellation_token())
+    {
+        return start_op(detail::reactor_op::read_op,
+                new detail::descriptor_read_op(scheduler_, descriptor_, data, size),
+                token);
+    }
+
+    /**
+     * @brief Writes at least one and at most @p size bytes from @p data.
+     *
+     * @param token If cancelled before anything has been written, the write
+     * is withdrawn and its future cancelled.
+     *
+     * @return A future holding the number of bytes written.
+     */
+    future<std::size_t> write_some(const void* data, std::size_t size,
+            const cancellation_token& token = cancellation_token())
+    {
+        return start_op(detail::reactor_op::write_op,
+                new detail::descriptor_write_op(scheduler_, descriptor_, data, size),
+                token);
+    }
+
+    /** @brief Cancels the pending operations. */
+    void cancel()
+    {
+        if(data_) {
+            scheduler_.get_reactor().cancel_ops(data_);
+        }
+    }
+
+    /** @brief Cancels the pending operations and closes the descriptor. */
+    void close()
+    {
+        if(descriptor_ != -1) {
+            scheduler_.get_reactor().deregister_descriptor(data_);
+            ::close(descriptor_);
+            descriptor_ = -1;
+        }
+    }
+
+private:
+    future<std::size_t> start_op(detail::reactor_op::op_type type,
+            detail::descriptor_op* op, const cancellation_token& token)
+    {
+        auto future = op->get_future();
+        if(!is_open()) {
+            op->ec_ = std::make_error_code(std::errc::bad_file_descriptor);
+            op->complete();
+        } else if(!op->watch(type, data_, token.state_)) {
+            op->ec_ = std::make_error_code(std::errc::operation_canceled);
+            op->complete();
+        } else {
+            scheduler_.get_reactor().start_op(type, data_, op);
+        }
+        return future;
+    }
+};
+
+} // ft
+
+#endif
@@ -0,0 +1,664 @@
+#ifndef FREETURES_TASK_HPP
+#define FREETURES_TASK_HPP
+
+#include "detail/config.hpp"
+
+#if FREETURES_HAS_COROUTINES
+
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <system_error>
+#include <utility>
+
+#include "error.hpp"
+#include "future.hpp"
+#include "promise.hpp"
+#include "scheduler.hpp"
+#include "detail/optional.hpp"
+#include "detail/scheduler.hpp"
+#include "detail/shared_state.hpp"
+#include "detail/slab_allocator.hpp"
+#include "detail/type_traits.hpp"
+
+namespace ft {
+
+template<typename T = void>
+class task;
+
+namespace detail {
+
+/** Grants the coroutine machinery access to the implementation of a scheduler. */
+struct scheduler_access
+{
+    static scheduler& impl(ft::scheduler& s) noexcept { return s.impl_; }
+};
+
+/**
+ * Allocates coroutine frames from the pool of a scheduler (or from the global
+ * heap if there is none). The pool a frame came from, and its size, are stored
+ * in front of it, so that the frame can be freed no matter which thread
+ * destroys it, and by any deallocation function.
+ */
+class frame_allocator
+{
+    union header
+    {
+        struct
+        {
+            slab_allocator* pool;
+            std::size_t size;
+        } frame;
+        std::max_align_t align;
+    };
+
+public:
+    static void* allocate(std::size_t size, slab_allocator* pool)
+    {
+        const std::size_t total = sizeof(header) + size;
+        auto* h = static_cast<header*>(pool ? pool->allocate(total) : ::operator new(total));
+        h->frame.pool = pool;
+        h->frame.size = total;
+        return h + 1;
+    }
+
+    static void deallocate(void* frame) noexcept
+    {
+        auto* h = static_cast<header*>(frame) - 1;
+        if(h->frame.pool) {
+            h->frame.pool->deallocate(h, h->frame.size);
+        } else {
+            ::operator delete(h);
+        }
+    }
+
+    /** The pool of the scheduler run by the calling thread, if any. */
+    static slab_allocator* current_pool() noexcept
+    {
+        scheduler* s = scheduler::current();
+        return s ? &s->get_allocator() : nullptr;
+    }
+};
+
+/**
+ * Stands for any parameter of a coroutine after its scheduler, so that the
+ * allocation functions below need not be templates: GCC pairs a coroutine's
+ * allocation and deallocation functions by name, and reports a function
+ * template allocation as mismatched with the (non-template) deallocation.
+ */
+struct any_argument
+{
+    template<typename T>
+    any_argument(T&&) noexcept {}
+};
+
+/**
+ * The allocation functions of the promises of freetures' coroutines: if the
+ * first parameter of the coroutine is a scheduler, and it has at most four
+ * more, its frame is allocated from that scheduler's pool, otherwise from the
+ * pool of the scheduler that the calling thread is running.
+ */
+struct pooled_frame
+{
+    using a = any_argument;
+
+    static void* operator new(std::size_t size)
+    {
+        return frame_allocator::allocate(size, frame_allocator::current_pool());
+    }
+
+    static void* operator new(std::size_t size, ft::scheduler& s)
+    {
+        return frame_allocator::allocate(size,
+                &scheduler_access::impl(s).get_allocator());
+    }
+
+    static void* operator new(std::size_t size, ft::scheduler& s, a)
+    { return operator new(size, s); }
+    static void* operator new(std::size_t size, ft::scheduler& s, a, a)
+    { return operator new(size, s); }
+    static void* operator new(std::size_t size, ft::scheduler& s, a, a, a)
+    { return operator new(size, s); }
+    static void* operator new(std::size_t size, ft::scheduler& s, a, a, a, a)
+    { return operator new(size, s); }
+
+    static void* operator new(std::size_t size, scheduler& s)
+    {
+        return frame_allocator::allocate(size, &s.get_allocator());
+    }
+
+    static void* operator new(std::size_t size, scheduler& s, a)
+    { return operator new(size, s); }
+    static void* operator new(std::size_t size, scheduler& s, a, a)
+    { return operator new(size, s); }
+    static void* operator new(std::size_t size, scheduler& s, a, a, a)
+    { return operator new(size, s); }
+    static void* operator new(std::size_t size, scheduler& s, a, a, a, a)
+    { return operator new(size, s); }
+
+    static void operator delete(void* frame, std::size_t) noexcept
+    {
+        frame_allocator::deallocate(frame);
+    }
+
+    // The counterparts of the placement allocation functions.
+    static void operator delete(void* frame, ft::scheduler&) noexcept
+    { frame_allocator::deallocate(frame); }
+    static void operator delete(void* frame, ft::scheduler&, a) noexcept
+    { frame_allocator::deallocate(frame); }
+    static void operator delete(void* frame, ft::scheduler&, a, a) noexcept
+    { frame_allocator::deallocate(frame); }
+    static void operator delete(void* frame, ft::scheduler&, a, a, a) noexcept
+    { frame_allocator::deallocate(frame); }
+    static void operator delete(void* frame, ft::scheduler&, a, a, a, a) noexcept
+    { frame_allocator::deallocate(frame); }
+    static void operator delete(void* frame, scheduler&) noexcept
+    { frame_allocator::deallocate(frame); }
+    static void operator delete(void* frame, scheduler&, a) noexcept
+    { frame_allocator::deallocate(frame); }
+    static void operator delete(void* frame, scheduler&, a, a) noexcept
+    { frame_allocator::deallocate(frame); }
+    static void operator delete(void* frame, scheduler&, a, a, a) noexcept
+    { frame_allocator::deallocate(frame); }
+    static void operator delete(void* frame, scheduler&, a, a, a, a) noexcept
+    { frame_allocator::deallocate(frame); }
+};
+
+/**
+ * The coroutine that runs a task spawned with @ref co_spawn. It's started by
+ * enqueueing its promise, which is a scheduler operation, in the scheduler's
+ * ready queue, and it destroys itself when it finishes.
+ *
+ * It's also the root of the chain of tasks that it awaits, which learn of it
+ * when they're awaited: if the future that one of them awaits is cancelled,
+ * none of them can be resumed, so the root is destroyed instead, and with it
+ * the whole chain.
+ */
+struct spawned_task
+{
+    struct promise_type : pooled_frame, scheduler_op
+    {
+        scheduler& scheduler_;
+        // Set if the coroutine is to be destroyed rather than resumed when the
+        // operation is executed.
+        bool cancelled_ = false;
+
+        template<typename... Args>
+        explicit promise_type(scheduler& s, Args&...) noexcept
+            : scheduler_op(&promise_type::do_complete)
+            , scheduler_(s)
+        {}
+
+        spawned_task get_return_object() noexcept
+        {
+            return spawned_task{this};
+        }
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() noexcept {}
+
+        // Exceptions are caught by spawn and fail the task's future, so none
+        // get here.
+        void unhandled_exception() noexcept
+        {
+            std::terminate();
+        }
+
+        promise_type* root() noexcept
+        {
+            return this;
+        }
+
+        /**
+         * Destroys the suspended coroutine from the scheduler's ready queue,
+         * which cancels the future returned by co_spawn. May be called from
+         * any thread.
+         */
+        void cancel()
+        {
+            cancelled_ = true;
+            scheduler_.post_ready_op(this);
+        }
+
+        static void do_complete(scheduler_op* op)
+        {
+            auto* p = static_cast<promise_type*>(op);
+            auto h = std::coroutine_handle<promise_type>::from_promise(*p);
+            if(p->cancelled_ || p->scheduler_.is_shutting_down()) {
+                h.destroy();
+            } else {
+                h.resume();
+            }
+        }
+    };
+
+    promise_type* promise;
+};
+
+/**
+ * The spawned coroutine that (indirectly) awaits the coroutine whose promise
+ * is @p p, or null if it's not awaited by one, or is not a freetures
+ * coroutine.
+ */
+template<typename Promise>
+auto spawn_root_of(Promise& p, int) noexcept -> decltype(p.root())
+{
+    return p.root();
+}
+
+template<typename Promise>
+spawned_task::promise_type* spawn_root_of(Promise&, long) noexcept
+{
+    return nullptr;
+}
+
+/**
+ * The part of a task's promise that doesn't depend on its result type: the
+ * awaiting coroutine, which is resumed once the task finishes, and the
+ * exception the task may have finished with.
+ */
+class task_promise_base : public pooled_frame
+{
+    std::coroutine_handle<> continuation_;
+    spawned_task::promise_type* root_ = nullptr;
+#if FREETURES_HAS_EXCEPTIONS
+    std::exception_ptr exception_;
+#endif
+
+    struct final_awaiter
+    {
+        bool await_ready() const noexcept { return false; }
+
+        // Resuming the awaiting coroutine by returning it, rather than calling
+        // resume, keeps the stack flat however long a chain of tasks is.
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+        {
+            std::coroutine_handle<> c = h.promise().continuation_;
+            return c ? c : std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+public:
+    // Tasks are lazy: they start when they are awaited.
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    final_awaiter final_suspend() const noexcept { return {}; }
+
+    void unhandled_exception() noexcept
+    {
+#if FREETURES_HAS_EXCEPTIONS
+        exception_ = std::current_exception();
+#else
+        std::terminate();
+#endif
+    }
+
+    void set_continuation(std::coroutine_handle<> c) noexcept
+    {
+        continuation_ = c;
+    }
+
+    void set_root(spawned_task::promise_type* root) noexcept
+    {
+        root_ = root;
+    }
+
+    spawned_task::promise_type* root() const noexcept
+    {
+        return root_;
+    }
+
+protected:
+    void rethrow_if_exception()
+    {
+#if FREETURES_HAS_EXCEPTIONS
+        if(exception_) {
+            std::rethrow_exception(exception_);
+        }
+#endif
+    }
+};
+
+template<typename T>
+class task_promise : public task_promise_base
+{
+    tl::optional<T> result_;
+
+public:
+    task<T> get_return_object() noexcept;
+
+    template<typename U>
+    void return_value(U&& value)
+    {
+        result_.emplace(std::forward<U>(value));
+    }
+
+    T result()
+    {
+        rethrow_if_exception();
+        return std::move(*result_);
+    }
+};
+
+template<>
+class task_promise<void> : public task_promise_base
+{
+public:
+    task<void> get_return_object() noexcept;
+
+    void return_void() noexcept {}
+
+    void result()
+    {
+        rethrow_if_exception();
+    }
+};
+
+/**
+ * Starts a task and suspends the coroutine that awaits it until it returns.
+ * The task is part of the same chain as the awaiting coroutine (see
+ * spawned_task).
+ */
+template<typename T>
+struct task_awaiter
+{
+    std::coroutine_handle<task_promise<T>> handle;
+
+    bool await_ready() const noexcept { return false; }
+
+    template<typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> caller) noexcept
+    {
+        handle.promise().set_continuation(caller);
+        handle.promise().set_root(spawn_root_of(caller.promise(), 0));
+        return handle;
+    }
+
+    T await_resume()
+    {
+        return handle.promise().result();
+    }
+};
+
+/**
+ * Suspends a coroutine until a future is ready. The awaiting coroutine is the
+ * future's continuation, so it's resumed by whichever thread runs the
+ * scheduler that fulfils the future, like any other continuation.
+ *
+ * If the future fails, its error is thrown from the `co_await` expression. If
+ * it's cancelled, its continuation is dropped, and the spawned coroutine that
+ * awaits this one is cancelled (see spawned_task).
+ */
+template<typename T>
+class future_awaiter
+{
+    // Resumes the coroutine, or cancels its spawned root if it's destroyed
+    // without having been invoked.
+    class resumer
+    {
+        future_awaiter* awaiter_;
+        std::coroutine_handle<> coroutine_;
+        spawned_task::promise_type* root_;
+
+    public:
+        resumer(future_awaiter* a, std::coroutine_handle<> h,
+                spawned_task::promise_type* root) noexcept
+            : awaiter_(a)
+            , coroutine_(h)
+            , root_(root)
+        {}
+
+        resumer(resumer&& other) noexcept
+            : awaiter_(other.awaiter_)
+            , coroutine_(std::exchange(other.coroutine_, nullptr))
+            , root_(other.root_)
+        {}
+
+        resumer& operator=(resumer&&) = delete;
+
+        ~resumer()
+        {
+            if(coroutine_ && root_) {
+                root_->cancel();
+            }
+        }
+
+        void operator()(completion<T> c)
+        {
+            if(c.has_value()) {
+                awaiter_->result_.emplace(std::move(c.value()));
+            } else {
+                awaiter_->error_ = c.error();
+            }
+            std::exchange(coroutine_, nullptr).resume();
+        }
+    };
+
+    future<T> future_;
+    tl::optional<T> result_;
+    std::error_code error_;
+
+public:
+    explicit future_awaiter(future<T> f) : future_(std::move(f)) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    template<typename Promise>
+    void await_suspend(std::coroutine_handle<Promise> h)
+    {
+        assert(future_.state_);
+        future_.state_->attach_continuation(continuation<T>(
+                resumer(this, h, spawn_root_of(h.promise(), 0))));
+    }
+
+    T await_resume()
+    {
+        if(!result_) {
+            throw_error(error_, "co_await");
+        }
+        return std::move(*result_);
+    }
+};
+
+} // detail
+
+/**
+ * @brief A lazily started coroutine that produces a `T` (or nothing).
+ *
+ * A task does nothing until it's awaited (with `co_await` in another coroutine)
+ * or spawned on a scheduler (see @ref co_spawn). Awaiting a task runs it right
+ * away, in the same thread, and resumes the awaiting coroutine once the task
+ * returns, without going through the scheduler. Within a task, futures may be
+ * awaited as well, which is where the coroutine suspends until the scheduler
+ * delivers the future's value.
+ *
+ * A task's frame is allocated from the pool of the scheduler passed as its
+ * first parameter, if any, or else from the pool of the scheduler the calling
+ * thread is running.
+ *
+ * @code
+ * ft::task<int> read_sensor(ft::scheduler& scheduler)
+ * {
+ *     co_await scheduler.wait(ft::milliseconds(10));
+ *     const std::string reply = co_await uart.read_line();
+ *     co_return parse(reply);
+ * }
+ *
+ * ft::task<> poll(ft::scheduler& scheduler)
+ * {
+ *     for(;;) {
+ *         log(co_await read_sensor(scheduler));
+ *     }
+ * }
+ *
+ * ft::co_spawn(scheduler, poll(scheduler));
+ * scheduler.run();
+ * @endcode
+ *
+ * An exception that escapes a task is rethrown in the awaiting coroutine. An
+ * awaited future that fails with an error or a timeout throws a
+ * `std::system_error` (or, without exceptions, calls the fatal handler, see
+ * @ref set_fatal_handler). An awaited future that is cancelled never resumes
+ * its task: the task spawned with @ref co_spawn that awaits it is destroyed
+ * instead, along with the tasks it awaits.
+ */
+template<typename T>
+class task
+{
+public:
+    using promise_type = detail::task_promise<T>;
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+
+    friend promise_type;
+
+    explicit task(std::coroutine_handle<promise_type> h) noexcept : handle_(h) {}
+
+public:
+    task(task&& other) noexcept
+        : handle_(std::exchange(other.handle_, nullptr))
+    {}
+
+    task& operator=(task&& other) noexcept
+    {
+        if(this != &other) {
+            if(handle_) {
+                handle_.destroy();
+            }
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+
+    ~task()
+    {
+        if(handle_) {
+            handle_.destroy();
+        }
+    }
+
+    /** Starts the task and suspends the awaiting coroutine until it returns. */
+    detail::task_awaiter<T> operator co_await() && noexcept
+    {
+        assert(handle_);
+        return detail::task_awaiter<T>{handle_};
+    }
+};
+
+namespace detail {
+
+template<typename T>
+task<T> task_promise<T>::get_return_object() noexcept
+{
+    return task<T>(std::coroutine_handle<task_promise>::from_promise(*this));
+}
+
+inline task<void> task_promise<void>::get_return_object() noexcept
+{
+    return task<void>(std::coroutine_handle<task_promise>::from_promise(*this));
+}
+
+#if FREETURES_HAS_EXCEPTIONS
+/**
+ * The error through which the exception being handled fails the future of a
+ * spawned task: the code of a `std::system_error`, e.g. that of a failed
+ * await, and `future_errc::unhandled_exception` for anything else.
+ */
+inline std::error_code current_exception_error() noexcept
+{
+    try {
+        throw;
+    } catch(const std::system_error& e) {
+        return e.code();
+    } catch(...) {
+        return make_error_code(future_errc::unhandled_exception);
+    }
+}
+#endif
+
+template<typename T, typename R>
+spawned_task spawn(scheduler& s, task<T> t, promise<R> p)
+{
+#if FREETURES_HAS_EXCEPTIONS
+    try {
+        p.set_value(co_await std::move(t));
+    } catch(...) {
+        p.set_failure(current_exception_error());
+    }
+#else
+    p.set_value(co_await std::move(t));
+#endif
+    s.post_ready_promise(std::move(p));
+}
+
+template<typename R>
+spawned_task spawn(scheduler& s, task<void> t, promise<R> p)
+{
+#if FREETURES_HAS_EXCEPTIONS
+    try {
+        co_await std::move(t);
+        p.set_value(null_tag());
+    } catch(...) {
+        p.set_failure(current_exception_error());
+    }
+#else
+    co_await std::move(t);
+    p.set_value(null_tag());
+#endif
+    s.post_ready_promise(std::move(p));
+}
+
+} // detail
+
+/**
+ * @brief Suspends the awaiting coroutine until @p f is ready, and resumes it
+ * with its value.
+ *
+ * The future's continuation is the coroutine itself, so awaiting a future
+ * costs no more than attaching a handler with @ref future::then.
+ */
+template<typename T>
+detail::future_awaiter<T> operator co_await(future<T> f)
+{
+    return detail::future_awaiter<T>(std::move(f));
+}
+
+/**
+ * @brief Runs @p t on @p s.
+ *
+ * The task is started from the scheduler's ready queue, i.e. once a thread
+ * runs the scheduler, and its result is delivered through the returned future
+ * like that of any other asynchronous operation.
+ *
+ * An exception that escapes the task fails the future with the code of the
+ * `std::system_error` (e.g. that of a failed await), or with
+ * `future_errc::unhandled_exception`. If a future awaited by the task (or by
+ * the tasks it awaits) is cancelled, the task is destroyed, and the future is
+ * cancelled.
+ */
+template<
+    typename T,
+    typename R = typename detail::non_void<T>::type
+> future<R> co_spawn(scheduler& s, task<T> t)
+{
+    detail::scheduler& impl = detail::scheduler_access::impl(s);
+    promise<R> p(impl);
+    future<R> f = p.get_future();
+    detail::spawned_task spawned = detail::spawn(impl, std::move(t), std::move(p));
+    impl.post_ready_op(spawned.promise);
+    return f;
+}
+
+} // ft
+
+#endif // FREETURES_HAS_COROUTINES
+
+#endif
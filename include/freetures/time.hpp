@@ -19,6 +19,21 @@ using std::chrono::hours;
 using std::chrono::duration_cast;
 using std::chrono::time_point_cast;
 
+/**
+ * @brief What a repeating timer does about the deadlines that passed while its
+ * handler couldn't be invoked, e.g. because the previous invocation overran
+ * its period.
+ */
+enum class catch_up
+{
+    // Invoke the handler for every missed deadline, back to back.
+    fire_all,
+    // Drop the missed deadlines and continue with the next one to come.
+    skip_missed,
+    // Like skip_missed, but tell the handler how many deadlines were dropped.
+    coalesce,
+};
+
 } // ft
 
 #endif
@@ -0,0 +1,126 @@
+#ifndef FREETURES_TIMER_HPP
+#define FREETURES_TIMER_HPP
+
+#include <cstddef>
+#include <utility>
+
+#include "time.hpp"
+#include "scheduler.hpp"
+#include "detail/timer.hpp"
+
+namespace ft {
+
+/**
+ * @brief A timer that can be armed over and over without allocating, for
+ * periodic work such as sampling a sensor.
+ *
+ * Unlike @ref scheduler::wait, which creates a new future on each call, a
+ * timer keeps its handler and the operation that is queued in the scheduler,
+ * so waiting again, and every repetition of a repeating timer, is free of
+ * allocations.
+ *
+ * @code
+ * ft::scheduler scheduler;
+ * ft::timer sampler(scheduler);
+ * sampler.repeat([&sensor](std::size_t missed) {
+ *     sensor.sample();
+ *     if(missed > 0) {
+ *         std::cerr << "missed " << missed << " samples\n";
+ *     }
+ * }, ft::milliseconds(1), ft::catch_up::coalesce);
+ * scheduler.run();
+ * @endcode
+ *
+ * A timer must not be used by multiple threads at the same time, and its
+ * handler counts as a use. Destroying a timer cancels it.
+ */
+class timer
+{
+    detail::timer impl_;
+
+public:
+    explicit timer(scheduler& s) : impl_(s.impl_) {}
+
+    /** @brief The point in time at which the next wait completes. */
+    time_point expiry() const noexcept
+    {
+        return impl_.expiry();
+    }
+
+    /**
+     * @brief Sets the point in time at which the next wait completes. Doesn't
+     * affect a wait that is already in progress.
+     */
+    void expires_at(time_point t) noexcept
+    {
+        impl_.expires_at(t);
+    }
+
+    /** @brief Like @ref expires_at, relative to now. */
+    void expires_after(duration d) noexcept
+    {
+        impl_.expires_after(d);
+    }
+
+    /**
+     * @brief Invokes @p handler by @ref scheduler::run once the expiry time
+     * has been reached.
+     *
+     * A wait already in progress is cancelled, i.e. its handler is not
+     * invoked. @p handler may re-arm, cancel or destroy the timer.
+     */
+    template<typename F>
+    void async_wait(F&& handler)
+    {
+        impl_.async_wait(std::forward<F>(handler));
+    }
+
+    /**
+     * @brief Waits again with the handler of the previous wait or repetition,
+     * without allocating.
+     *
+     * @code
+     * timer.async_wait([&timer] {
+     *     poll();
+     *     timer.expires_at(timer.expiry() + ft::milliseconds(10));
+     *     timer.async_wait();
+     * });
+     * @endcode
+     */
+    void async_wait()
+    {
+        impl_.async_wait();
+    }
+
+    /**
+     * @brief Invokes @p handler every @p period, starting @p period from now.
+     *
+     * The deadlines are kept on a fixed grid, so the invocations don't drift
+     * even if some of them are late. @p policy decides what happens to the
+     * deadlines that pass while the handler can't be invoked, e.g. because it
+     * overran its period. @p handler may take a `std::size_t`, which is the
+     * number of deadlines coalesced into the invocation with @ref
+     * catch_up::coalesce, and 0 otherwise.
+     */
+    template<typename F>
+    void repeat(F&& handler, duration period,
+            catch_up policy = catch_up::fire_all)
+    {
+        impl_.repeat(std::forward<F>(handler), period, policy);
+    }
+
+    /**
+     * @brief Cancels the wait or repetition in progress, if any. Its handler
+     * won't be invoked.
+     *
+     * @return False if there was nothing to cancel.
+     */
+    bool cancel()
+    {
+        return impl_.cancel();
+    }
+};
+
+} // ft
+
+#endif
@@ -0,0 +1,247 @@
+#ifndef FREETURES_WHEN_ALL_HPP
+#define FREETURES_WHEN_ALL_HPP
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "future.hpp"
+#include "promise.hpp"
+#include "detail/join_block.hpp"
+#include "detail/optional.hpp"
+#include "detail/shared_state.hpp"
+
+namespace ft {
+namespace detail {
+
+/**
+ * Collects the results of a fixed set of futures of types `Ts...` into a tuple.
+ * The results are kept in the block itself, next to the number of inputs that
+ * are yet to complete.
+ *
+ * The first input to fail (with an error or timeout) completes the block's
+ * future with its failure right away; the results of the others are dropped.
+ */
+template<typename... Ts>
+class when_all_block : public join_block<when_all_block<Ts...>>
+{
+    using result_type = std::tuple<Ts...>;
+
+    promise<result_type> promise_;
+    std::tuple<optional<Ts>...> results_;
+    std::atomic<std::size_t> num_pending_;
+    std::atomic<bool> is_done_{false};
+
+public:
+    explicit when_all_block(scheduler& s)
+        : join_block<when_all_block>(s)
+        , promise_(s)
+        , num_pending_(sizeof...(Ts))
+    {}
+
+    future<result_type> get_future() { return promise_.get_future(); }
+
+    template<std::size_t I, typename T>
+    void set_result(T&& t)
+    {
+        std::get<I>(results_).emplace(std::move(t));
+        if(num_pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            complete(std::index_sequence_for<Ts...>());
+        }
+    }
+
+    void set_failure(std::error_code error)
+    {
+        if(is_done_.exchange(true, std::memory_order_acq_rel)) {
+            return;
+        }
+        promise_.set_failure(error);
+        this->get_scheduler().dispatch_ready_promise(std::move(promise_));
+    }
+
+private:
+    template<std::size_t... Is>
+    void complete(std::index_sequence<Is...>)
+    {
+        if(is_done_.exchange(true, std::memory_order_acq_rel)) {
+            return;
+        }
+        promise_.set_value(result_type(std::move(*std::get<Is>(results_))...));
+        this->get_scheduler().dispatch_ready_promise(std::move(promise_));
+    }
+};
+
+/**
+ * Collects the results of a range of futures of type `T` into a vector. The
+ * results are kept in an array following the block. Failures are handled like
+ * in @ref when_all_block.
+ */
+template<typename T>
+class when_all_range_block : public join_block<when_all_range_block<T>>
+{
+    using base = join_block<when_all_range_block>;
+
+    promise<std::vector<T>> promise_;
+    const std::size_t num_inputs_;
+    std::atomic<std::size_t> num_pending_;
+    std::atomic<bool> is_done_{false};
+
+public:
+    when_all_range_block(scheduler& s, std::size_t n)
+        : base(s)
+        , promise_(s)
+        , num_inputs_(n)
+        , num_pending_(n)
+    {
+        for(std::size_t i = 0; i < num_inputs_; ++i) {
+            ::new(results() + i) optional<T>();
+        }
+    }
+
+    ~when_all_range_block()
+    {
+        for(std::size_t i = 0; i < num_inputs_; ++i) {
+            results()[i].~optional<T>();
+        }
+    }
+
+    static intrusive_ptr<when_all_range_block> create(scheduler& s, std::size_t n)
+    {
+        return base::template create_with_trailing<optional<T>>(n, s, n);
+    }
+
+    future<std::vector<T>> get_future() { return promise_.get_future(); }
+
+    void set_result(std::size_t i, T&& t)
+    {
+        results()[i].emplace(std::move(t));
+        if(num_pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            complete();
+        }
+    }
+
+    void set_failure(std::error_code error)
+    {
+        if(is_done_.exchange(true, std::memory_order_acq_rel)) {
+            return;
+        }
+        promise_.set_failure(error);
+        this->get_scheduler().dispatch_ready_promise(std::move(promise_));
+    }
+
+private:
+    optional<T>* results() noexcept
+    {
+        return this->template trailing<optional<T>>();
+    }
+
+    void complete()
+    {
+        if(is_done_.exchange(true, std::memory_order_acq_rel)) {
+            return;
+        }
+        std::vector<T> values;
+        values.reserve(num_inputs_);
+        for(std::size_t i = 0; i < num_inputs_; ++i) {
+            values.push_back(std::move(*results()[i]));
+        }
+        promise_.set_value(std::move(values));
+        this->get_scheduler().dispatch_ready_promise(std::move(promise_));
+    }
+};
+
+template<std::size_t I, typename Block, typename T>
+void attach_to_when_all(const intrusive_ptr<Block>& block, future<T>& f)
+{
+    assert(f.state_);
+    f.state_->attach_continuation(continuation<T>([block](completion<T> c) {
+        if(c.has_value()) {
+            block->template set_result<I>(std::move(c.value()));
+        } else {
+            block->set_failure(c.error());
+        }
+    }));
+}
+
+template<typename... Ts, std::size_t... Is>
+future<std::tuple<Ts...>> when_all(std::index_sequence<Is...>, future<Ts>&... fs)
+{
+    scheduler& s = std::get<0>(std::tie(fs...)).state_->get_scheduler();
+    auto block = when_all_block<Ts...>::create(s);
+    auto result = block->get_future();
+    (void)std::initializer_list<int>{(attach_to_when_all<Is>(block, fs), 0)...};
+    return result;
+}
+
+} // detail
+
+/**
+ * @brief Returns a future that is ready once all of @p fs are, with a tuple of
+ * their values.
+ *
+ * Unlike joining the futures by hand, with a counter and a promise captured by
+ * each handler, this allocates a single block that holds the results and the
+ * count of pending inputs, and the handler attached to each input is small
+ * enough not to allocate. The result is delivered by the scheduler of the
+ * first future.
+ *
+ * @code
+ * ft::when_all(gps.query_position(), lora.query_rssi(), modem.query_signal())
+ *     .then([](std::tuple<position, int, int> results) {
+ *         // All three modules have replied.
+ *     });
+ * @endcode
+ *
+ * If any of @p fs fails with an error or a timeout, the returned future fails
+ * with it as soon as it does, without waiting for the others.
+ *
+ * The continuations of @p fs are taken over, so @p fs may not be continued by
+ * anything else.
+ */
+template<typename T, typename... Ts>
+future<std::tuple<T, Ts...>> when_all(future<T> f, future<Ts>... fs)
+{
+    return detail::when_all(std::index_sequence_for<T, Ts...>(), f, fs...);
+}
+
+/**
+ * @brief Returns a future that is ready once all the futures in [@p first, @p
+ * last) are, with a vector of their values in the same order.
+ *
+ * The results are collected in a single block allocated for the whole range.
+ * The range must not be empty.
+ */
+template<
+    typename Iterator,
+    typename T = typename detail::inner_result_type<
+        typename std::iterator_traits<Iterator>::value_type>::type
+> future<std::vector<T>> when_all(Iterator first, Iterator last)
+{
+    assert(first != last);
+    const auto n = static_cast<std::size_t>(std::distance(first, last));
+    detail::scheduler& s = first->state_->get_scheduler();
+    auto block = detail::when_all_range_block<T>::create(s, n);
+    auto result = block->get_future();
+    for(std::size_t i = 0; first != last; ++first, ++i) {
+        assert(first->state_);
+        first->state_->attach_continuation(detail::continuation<T>(
+            [block, i](detail::completion<T> c) {
+                if(c.has_value()) {
+                    block->set_result(i, std::move(c.value()));
+                } else {
+                    block->set_failure(c.error());
+                }
+            }));
+    }
+    return result;
+}
+
+} // ft
+
+#endif
@@ -0,0 +1,321 @@
+#ifndef FREETURES_WHEN_ANY_HPP
+#define FREETURES_WHEN_ANY_HPP
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "cancellation.hpp"
+#include "future.hpp"
+#include "promise.hpp"
+#include "detail/join_block.hpp"
+#include "detail/shared_state.hpp"
+
+namespace ft {
+
+/** @brief The result of @ref when_any. */
+template<typename T>
+struct when_any_result
+{
+    // The position of the future that completed first among the inputs.
+    std::size_t index;
+    T value;
+};
+
+namespace detail {
+
+/**
+ * Delivers the result of whichever of its inputs completes first. The block
+ * is followed by an array of pointers to its inputs' shared states, through
+ * which the continuations of the losers are detached once there's a winner.
+ *
+ * Each pointer holds a reference to its state, as the state's continuation
+ * may have been forwarded to another state (when the input is the future of
+ * a handler that returned a future), after which nothing else need keep it
+ * alive. The states own the block through their continuations in turn, so
+ * the cycle is broken from both ends: a continuation releases its input's
+ * reference when it's destroyed, i.e. once its input completes or is
+ * abandoned, and the winner releases all of them. Whoever takes a pointer
+ * out of the array releases its reference.
+ */
+template<typename T>
+class when_any_block : public join_block<when_any_block<T>>
+{
+    using base = join_block<when_any_block>;
+    using state_type = shared_state<T>;
+    using input_type = std::atomic<state_type*>;
+
+    promise<when_any_result<T>> promise_;
+    const std::size_t num_inputs_;
+    std::atomic<bool> is_done_{false};
+    intrusive_ptr<cancellation_state> cancellation_;
+
+public:
+    when_any_block(scheduler& s, std::size_t n)
+        : base(s)
+        , promise_(s)
+        , num_inputs_(n)
+    {
+        for(std::size_t i = 0; i < num_inputs_; ++i) {
+            ::new(&inputs()[i]) input_type(nullptr);
+        }
+    }
+
+    ~when_any_block()
+    {
+        for(std::size_t i = 0; i < num_inputs_; ++i) {
+            forget_input(i);
+        }
+    }
+
+    static intrusive_ptr<when_any_block> create(scheduler& s, std::size_t n)
+    {
+        return base::template create_with_trailing<input_type>(n, s, n);
+    }
+
+    future<when_any_result<T>> get_future() { return promise_.get_future(); }
+
+    /** Makes the winner cancel @p source. */
+    void set_cancellation(const cancellation_source& source) noexcept
+    {
+        cancellation_ = source.state_;
+    }
+
+    void set_input(std::size_t i, state_type* state) noexcept
+    {
+        state->add_ref();
+        inputs()[i].store(state, std::memory_order_release);
+    }
+
+    void forget_input(std::size_t i) noexcept
+    {
+        if(state_type* state = inputs()[i].exchange(nullptr, std::memory_order_acq_rel)) {
+            state->release();
+        }
+    }
+
+    void set_result(std::size_t i, completion<T> c)
+    {
+        if(is_done_.exchange(true, std::memory_order_acq_rel)) {
+            return;
+        }
+        cancel_losers(i);
+        // The losers' operations are withdrawn before anyone learns of the
+        // winner. The winner's own operation has already left the source.
+        if(cancellation_) {
+            cancellation_->cancel();
+        }
+        // The winner is kept alive by whoever invokes its continuation.
+        forget_input(i);
+        if(c.has_value()) {
+            promise_.set_value(when_any_result<T>{i, std::move(c.value())});
+        } else {
+            promise_.set_failure(c.error());
+        }
+        this->get_scheduler().dispatch_ready_promise(std::move(promise_));
+    }
+
+private:
+    input_type* inputs() noexcept
+    {
+        return this->template trailing<input_type>();
+    }
+
+    /**
+     * Drops the continuations of the inputs other than @p winner, releasing
+     * their references to the block, and the block's references to them.
+     *
+     * A loser can only be detached if nothing else can be completing it at the
+     * same time, i.e. if its scheduler is run by this thread alone. Otherwise
+     * its continuation stays attached and merely sees that the race is over.
+     */
+    void cancel_losers(std::size_t winner) noexcept
+    {
+        for(std::size_t i = 0; i < num_inputs_; ++i) {
+            if(i == winner) {
+                continue;
+            }
+            // Taking the pointer makes its reference ours, which keeps the
+            // state alive, and with it any state it has been forwarded to.
+            state_type* state = inputs()[i].exchange(nullptr, std::memory_order_acq_rel);
+            if(state == nullptr) {
+                continue;
+            }
+            scheduler& s = state->get_scheduler();
+            if(!s.is_concurrent() && s.running_in_this_thread()) {
+                // This destroys the loser's continuation, but not the block,
+                // as the winner's continuation still holds a reference.
+                state->detach_continuation();
+            }
+            state->release();
+        }
+    }
+};
+
+/** The continuation that @ref when_any attaches to each of its inputs. */
+template<typename T>
+class when_any_continuation
+{
+    intrusive_ptr<when_any_block<T>> block_;
+    std::size_t index_;
+
+public:
+    when_any_continuation(intrusive_ptr<when_any_block<T>> block, std::size_t index)
+        : block_(std::move(block))
+        , index_(index)
+    {}
+
+    when_any_continuation(when_any_continuation&&) noexcept = default;
+
+    ~when_any_continuation()
+    {
+        if(block_) {
+            block_->forget_input(index_);
+        }
+    }
+
+    void operator()(completion<T> c)
+    {
+        block_->set_result(index_, c);
+    }
+};
+
+template<typename T>
+void attach_to_when_any(const intrusive_ptr<when_any_block<T>>& block,
+        std::size_t i, future<T>& f)
+{
+    assert(f.state_);
+    block->set_input(i, f.state_.get());
+    f.state_->attach_continuation(continuation<T>(when_any_continuation<T>(block, i)));
+}
+
+} // detail
+
+/**
+ * @brief Returns a future that is ready once the first of @p fs is, with its
+ * value and its position among @p fs.
+ *
+ * If the first future to complete fails with an error or a timeout, so does
+ * the returned future.
+ *
+ * The handlers attached to the other futures, the losers, are detached from
+ * them, so that they no longer keep the shared block alive and the losers'
+ * operations find nothing to continue when they complete. (If a loser belongs
+ * to a scheduler that is run by multiple threads or by another thread, its
+ * handler stays attached and merely discards the late result.)
+ *
+ * Detaching a loser's handler doesn't stop its operation. To have the losers'
+ * operations withdrawn too, e.g. a timeout's timer removed from the timer
+ * wheel, start them with the tokens of a @ref cancellation_source and pass it
+ * to the overload below, which cancels the source once there's a winner.
+ *
+ * @code
+ * ft::when_any(primary.query_time(), fallback.query_time())
+ *     .then([](ft::when_any_result<timestamp> first) {
+ *         // first.index is 0 if the primary replied first.
+ *     });
+ * @endcode
+ */
+template<typename T, typename... Ts>
+future<when_any_result<T>> when_any(future<T> f, future<Ts>... fs)
+{
+    static_assert(std::is_same<std::tuple<T, Ts...>, std::tuple<T, typename
+            std::conditional<true, T, Ts>::type...>>::value,
+            "when_any requires futures of the same type");
+    detail::scheduler& s = f.state_->get_scheduler();
+    auto block = detail::when_any_block<T>::create(s, 1 + sizeof...(Ts));
+    auto result = block->get_future();
+    std::size_t i = 0;
+    detail::attach_to_when_any(block, i++, f);
+    (void)std::initializer_list<int>{(detail::attach_to_when_any(block, i++, fs), 0)...};
+    return result;
+}
+
+/**
+ * @brief Like the above, but also cancels @p source once the first of @p fs
+ * is ready, withdrawing the operations of the losers that were started with
+ * its tokens.
+ *
+ * @code
+ * ft::cancellation_source race;
+ * ft::when_any(race, link.receive(race.get_token()),
+ *         scheduler.wait(ft::seconds(5), race.get_token()).then([] { return frame(); }))
+ *     .then([](ft::when_any_result<frame> first) {
+ *         // If the frame arrived first, the timeout is no longer scheduled,
+ *         // and if it didn't, the receive is no longer pending.
+ *     });
+ * @endcode
+ *
+ * The source should not be shared with operations that must outlive the race.
+ */
+template<typename T, typename... Ts>
+future<when_any_result<T>> when_any(const cancellation_source& source,
+        future<T> f, future<Ts>... fs)
+{
+    static_assert(std::is_same<std::tuple<T, Ts...>, std::tuple<T, typename
+            std::conditional<true, T, Ts>::type...>>::value,
+            "when_any requires futures of the same type");
+    detail::scheduler& s = f.state_->get_scheduler();
+    auto block = detail::when_any_block<T>::create(s, 1 + sizeof...(Ts));
+    block->set_cancellation(source);
+    auto result = block->get_future();
+    std::size_t i = 0;
+    detail::attach_to_when_any(block, i++, f);
+    (void)std::initializer_list<int>{(detail::attach_to_when_any(block, i++, fs), 0)...};
+    return result;
+}
+
+/**
+ * @brief Returns a future that is ready once the first of the futures in [@p
+ * first, @p last) is, with its value and its position in the range.
+ *
+ * The range must not be empty. See the variadic overloads for the losers.
+ */
+template<
+    typename Iterator,
+    typename T = typename detail::inner_result_type<
+        typename std::iterator_traits<Iterator>::value_type>::type
+> future<when_any_result<T>> when_any(Iterator first, Iterator last)
+{
+    assert(first != last);
+    const auto n = static_cast<std::size_t>(std::distance(first, last));
+    detail::scheduler& s = first->state_->get_scheduler();
+    auto block = detail::when_any_block<T>::create(s, n);
+    auto result = block->get_future();
+    for(std::size_t i = 0; first != last; ++first, ++i) {
+        detail::attach_to_when_any(block, i, *first);
+    }
+    return result;
+}
+
+/**
+ * @brief Like the above, but also cancels @p source once the first of the
+ * futures in [@p first, @p last) is ready.
+ */
+template<
+    typename Iterator,
+    typename T = typename detail::inner_result_type<
+        typename std::iterator_traits<Iterator>::value_type>::type
+> future<when_any_result<T>> when_any(const cancellation_source& source,
+        Iterator first, Iterator last)
+{
+    assert(first != last);
+    const auto n = static_cast<std::size_t>(std::distance(first, last));
+    detail::scheduler& s = first->state_->get_scheduler();
+    auto block = detail::when_any_block<T>::create(s, n);
+    block->set_cancellation(source);
+    auto result = block->get_future();
+    for(std::size_t i = 0; first != last; ++first, ++i) {
+        detail::attach_to_when_any(block, i, *first);
+    }
+    return result;
+}
+
+} // ft
+
+#endif